@@ -0,0 +1,744 @@
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <forward_list>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "LinkedList.h"
+#include "PoolAllocator.h"
+#include "StackAllocator.h"
+#include "StackArena.h"
+#include "UnrolledLinkedList.h"
+
+// Benchmark suite for LinkedList, UnrolledLinkedList and std::forward_list,
+// each with std::allocator, StackAllocator, an ArenaAllocator on a shared
+// StackArena and PoolAllocator, over several element types, sizes and
+// operations. Every benchmark runs warmup passes, then repeated samples, and
+// reports the median and p99 in nanoseconds per element, or per push/pop
+// pair for churn. A footprint entry per container, element type and size
+// reports the bytes the allocator handed out per element.
+//
+//   list_benchmark [--max-size N] [--reps N] [--warmup N] [--budget SEC]
+//                  [--filter TEXT] [--perf] [--json FILE]
+
+namespace {
+
+// Define a structure for the command line options
+struct Config {
+  size_t max_size = 1'000'000;  // 10M needs a few GB for the stack arenas
+  int reps = 11;                // Measured samples per benchmark
+  int warmup = 2;               // Unmeasured passes before the samples
+  double budget = 1.0;          // Seconds after which sampling stops early
+  std::string filter;           // Only run benchmarks whose name contains it
+  bool perf = false;            // Collect hardware counters
+  const char* json = nullptr;   // Write the results here
+};
+
+// Define a structure for one benchmark result
+struct Result {
+  std::string name;
+  std::string container;
+  std::string allocator;
+  std::string element;
+  std::string op;
+  size_t size = 0;
+  size_t samples = 0;
+  double median_ns = 0;  // Per element
+  double p99_ns = 0;     // Per element
+  double instructions = -1;  // Per element, -1 when not measured
+  double cache_misses = -1;  // Per element, -1 when not measured
+  double bytes_per_element = -1;  // Footprint entries only
+};
+
+// Elements: a plain int, a 64-byte struct and a string too long for the
+// small string optimization, so each one owns a heap buffer
+struct Payload {
+  int64_t values[8];
+};
+static_assert(sizeof(Payload) == 64, "Payload must be 64 bytes");
+
+template <typename T>
+T make_value(size_t i);
+
+template <>
+int make_value<int>(size_t i) {
+  return static_cast<int>(i);
+}
+
+template <>
+Payload make_value<Payload>(size_t i) {
+  Payload p{};
+  p.values[0] = static_cast<int64_t>(i);
+  return p;
+}
+
+template <>
+std::string make_value<std::string>(size_t i) {
+  return "benchmark element " + std::to_string(i);
+}
+
+// Function to fold an element into a checksum, so loops are not optimized out
+inline size_t weight(int v) { return static_cast<size_t>(v); }
+inline size_t weight(const Payload& v) {
+  return static_cast<size_t>(v.values[0]);
+}
+inline size_t weight(const std::string& v) { return v.size(); }
+
+volatile size_t SINK = 0;
+
+template <typename T>
+const char* element_name();
+template <>
+const char* element_name<int>() {
+  return "int";
+}
+template <>
+const char* element_name<Payload>() {
+  return "struct64";
+}
+template <>
+const char* element_name<std::string>() {
+  return "string";
+}
+
+// Operations. Churn is the steady state of a queue: a list of n elements
+// gets CHURN_OPS rounds of appending one element and popping the first, so it
+// never grows but every node is freed out of allocation order. Scattered
+// iterates a list whose nodes were shuffled in memory by a sort on their
+// addresses, as after long runs of pushes and pops; Compact times compact()
+// on such a list and Compacted iterates it afterwards. Sort sorts a list by
+// element weight. UnrolledLinkedList has none of the last four, and
+// forward_list has no compact().
+enum class Op {
+  PushFront,
+  PushBack,
+  Iterate,
+  Copy,
+  Clear,
+  Churn,
+  Sort,
+  Scattered,
+  Compact,
+  Compacted
+};
+constexpr Op OPS[] = {Op::PushFront, Op::PushBack,  Op::Iterate,
+                      Op::Copy,      Op::Clear,     Op::Churn,
+                      Op::Sort,      Op::Scattered, Op::Compact,
+                      Op::Compacted};
+constexpr size_t CHURN_OPS = 2'000'000;
+
+// Copying a list copies its allocator by value, through a temporary on the
+// stack, so lists that carry a StackAllocator arena inline can only be copied
+// while the arena fits comfortably into the thread's stack
+constexpr size_t STACK_COPY_LIMIT = 1 << 20;
+constexpr size_t MIN_ELEMENTS_PER_SAMPLE = 100'000;
+
+const char* op_name(Op op) {
+  switch (op) {
+    case Op::PushFront:
+      return "push_front";
+    case Op::PushBack:
+      return "push_back";
+    case Op::Iterate:
+      return "iterate";
+    case Op::Copy:
+      return "copy";
+    case Op::Clear:
+      return "clear";
+    case Op::Churn:
+      return "churn";
+    case Op::Sort:
+      return "sort";
+    case Op::Scattered:
+      return "iterate_scattered";
+    case Op::Compact:
+      return "compact";
+    case Op::Compacted:
+      return "iterate_compacted";
+  }
+  return "";
+}
+
+template <typename List>
+struct IsForwardList : std::false_type {};
+template <typename T, typename A>
+struct IsForwardList<std::forward_list<T, A>> : std::true_type {};
+
+template <typename List>
+struct IsUnrolled : std::false_type {};
+template <typename T, typename A, size_t B>
+struct IsUnrolled<UnrolledLinkedList<T, A, B>> : std::true_type {};
+
+// Function to tell whether a container runs an operation at all
+template <typename List>
+constexpr bool supports(Op op) {
+  switch (op) {
+    case Op::Sort:
+    case Op::Scattered:
+      return !IsUnrolled<List>::value;
+    case Op::Compact:
+    case Op::Compacted:
+      return !IsUnrolled<List>::value && !IsForwardList<List>::value;
+    default:
+      return true;
+  }
+}
+
+// Function to fold a list into a checksum. UnrolledLinkedList goes a node at
+// a time through for_each_span(), so the inner loop runs over an array.
+template <typename List>
+size_t traverse(const List& list) {
+  size_t checksum = 0;
+  if constexpr (IsUnrolled<List>::value) {
+    list.for_each_span([&checksum](const auto* first, const auto* last) {
+      for (; first != last; ++first) {
+        checksum += weight(*first);
+      }
+    });
+  } else {
+    for (const auto& v : list) {
+      checksum += weight(v);
+    }
+  }
+  return checksum;
+}
+
+// Function to append values; forward_list has no push_back, so it inserts
+// after the last node instead
+template <typename List, typename T>
+void append_all(List& list, const std::vector<T>& values, size_t n) {
+  if constexpr (IsForwardList<List>::value) {
+    auto tail = list.before_begin();
+    for (size_t i = 0; i < n; ++i) {
+      tail = list.insert_after(tail, values[i % values.size()]);
+    }
+  } else {
+    for (size_t i = 0; i < n; ++i) {
+      list.push_back(values[i % values.size()]);
+    }
+  }
+}
+
+template <typename List, typename T>
+void prepend_all(List& list, const std::vector<T>& values, size_t n) {
+  for (size_t i = 0; i < n; ++i) {
+    list.push_front(values[i % values.size()]);
+  }
+}
+
+// Function to sort a list by element weight; ties keep their order
+template <typename List>
+void sort_by_weight(List& list) {
+  if constexpr (!IsUnrolled<List>::value) {
+    using T = typename List::value_type;
+    list.sort([](const T& a, const T& b) { return weight(a) < weight(b); });
+  }
+}
+
+// Function to shuffle the order of a list's nodes against their addresses.
+// Sorting relinks nodes without moving elements, and a hash of an element's
+// address is a fixed, well-mixed key while it runs.
+template <typename List>
+void scatter(List& list) {
+  if constexpr (!IsUnrolled<List>::value) {
+    using T = typename List::value_type;
+    auto key = [](const T& v) {
+      return reinterpret_cast<uintptr_t>(&v) * 0x9E3779B97F4A7C15ull;
+    };
+    list.sort([&key](const T& a, const T& b) { return key(a) < key(b); });
+  }
+}
+
+// Function to relocate a list's nodes in list order
+template <typename List>
+void compact(List& list) {
+  if constexpr (supports<List>(Op::Compact)) {
+    list.compact();
+  }
+}
+
+// Function to append a value and pop the first one, 'ops' times over
+template <typename List, typename T>
+void churn(List& list, const std::vector<T>& values, size_t ops) {
+  if constexpr (IsForwardList<List>::value) {
+    auto tail = list.before_begin();
+    for (auto next = list.begin(); next != list.end(); ++next) {
+      tail = next;
+    }
+    for (size_t i = 0; i < ops; ++i) {
+      tail = list.insert_after(tail, values[i % values.size()]);
+      list.pop_front();
+    }
+  } else {
+    for (size_t i = 0; i < ops; ++i) {
+      list.push_back(values[i % values.size()]);
+      list.pop_front();
+    }
+  }
+}
+
+// Hardware counters through perf_event_open: instructions and cache misses,
+// read as one group around the timed regions
+class PerfCounters {
+ public:
+  PerfCounters() = default;
+  PerfCounters(const PerfCounters&) = delete;
+  PerfCounters& operator=(const PerfCounters&) = delete;
+  ~PerfCounters() {
+    for (int fd : fds_) {
+      close(fd);
+    }
+  }
+
+  bool open() {
+    const uint64_t events[] = {PERF_COUNT_HW_INSTRUCTIONS,
+                               PERF_COUNT_HW_CACHE_MISSES};
+    for (uint64_t event : events) {
+      perf_event_attr attr{};
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.size = sizeof(attr);
+      attr.config = event;
+      attr.disabled = fds_.empty() ? 1 : 0;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      attr.read_format = PERF_FORMAT_GROUP;
+
+      int group = fds_.empty() ? -1 : fds_[0];
+      int fd = static_cast<int>(
+          syscall(SYS_perf_event_open, &attr, 0, -1, group, 0));
+      if (fd < 0) {
+        return false;
+      }
+      fds_.push_back(fd);
+    }
+    return true;
+  }
+
+  void start() {
+    ioctl(fds_[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(fds_[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+  }
+
+  // Function to stop counting and add the counts to the totals
+  void stop() {
+    ioctl(fds_[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    uint64_t values[3] = {};
+    if (read(fds_[0], values, sizeof(values)) > 0) {
+      instructions_ += values[1];
+      cache_misses_ += values[2];
+    }
+  }
+
+  void reset() { instructions_ = cache_misses_ = 0; }
+  uint64_t instructions() const { return instructions_; }
+  uint64_t cache_misses() const { return cache_misses_; }
+
+ private:
+  std::vector<int> fds_;
+  uint64_t instructions_ = 0;
+  uint64_t cache_misses_ = 0;
+};
+
+PerfCounters* PERF = nullptr;  // Set when --perf is given and works
+
+template <typename Alloc>
+struct IsArenaAllocator : std::false_type {};
+template <typename U>
+struct IsArenaAllocator<ArenaAllocator<U>> : std::true_type {};
+
+template <typename List>
+constexpr bool USES_ARENA =
+    IsArenaAllocator<typename List::allocator_type>::value;
+
+// Function to create an empty list; arena lists get a handle to 'arena'
+template <typename List>
+List* new_list(StackArena* arena) {
+  if constexpr (USES_ARENA<List>) {
+    return new List(ArenaAllocator<char>(*arena));
+  } else {
+    return new List;
+  }
+}
+
+// Function to run one operation on 'batch' fresh lists of n elements and
+// return the nanoseconds spent in the operation itself. Setup and teardown
+// stay outside the timed region. Lists are heap-allocated, since a
+// StackAllocator carries its whole arena inline. Arena lists all share
+// 'arena', which starts out empty for every sample.
+template <typename List, typename T>
+uint64_t run_sample(Op op, size_t n, size_t batch,
+                    const std::vector<T>& values, StackArena* arena) {
+  if (arena != nullptr) {
+    arena->reset();
+  }
+
+  std::vector<std::unique_ptr<List>> lists;
+  std::vector<std::unique_ptr<List>> copies;
+  for (size_t b = 0; b < batch; ++b) {
+    lists.emplace_back(new_list<List>(arena));
+    if (op != Op::PushFront && op != Op::PushBack) {
+      prepend_all(*lists.back(), values, n);
+    }
+    if (op == Op::Scattered || op == Op::Compact || op == Op::Compacted) {
+      scatter(*lists.back());
+    }
+    if (op == Op::Compacted) {
+      compact(*lists.back());
+    }
+  }
+  copies.reserve(batch);
+
+  size_t checksum = 0;
+  if (PERF != nullptr) {
+    PERF->start();
+  }
+  auto start = std::chrono::steady_clock::now();
+
+  for (auto& list : lists) {
+    switch (op) {
+      case Op::PushFront:
+        prepend_all(*list, values, n);
+        break;
+      case Op::PushBack:
+        append_all(*list, values, n);
+        break;
+      case Op::Iterate:
+      case Op::Scattered:
+      case Op::Compacted:
+        checksum += traverse(*list);
+        break;
+      case Op::Copy:
+        copies.emplace_back(new List(*list));
+        break;
+      case Op::Clear:
+        list->clear();
+        break;
+      case Op::Churn:
+        churn(*list, values, CHURN_OPS);
+        break;
+      case Op::Sort:
+        sort_by_weight(*list);
+        break;
+      case Op::Compact:
+        compact(*list);
+        break;
+    }
+  }
+
+  auto end = std::chrono::steady_clock::now();
+  if (PERF != nullptr) {
+    PERF->stop();
+  }
+  SINK = SINK + checksum;
+
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(end - start)
+      .count();
+}
+
+size_t FOOTPRINT_BYTES = 0;  // Bytes live in all CountingAllocators
+
+// std::allocator that keeps FOOTPRINT_BYTES up to date
+template <typename T>
+struct CountingAllocator : std::allocator<T> {
+  template <typename U>
+  struct rebind {
+    using other = CountingAllocator<U>;
+  };
+
+  CountingAllocator() = default;
+  template <typename U>
+  CountingAllocator(const CountingAllocator<U>&) noexcept {}
+
+  T* allocate(size_t n) {
+    FOOTPRINT_BYTES += n * sizeof(T);
+    return std::allocator<T>::allocate(n);
+  }
+
+  void deallocate(T* p, size_t n) noexcept {
+    FOOTPRINT_BYTES -= n * sizeof(T);
+    std::allocator<T>::deallocate(p, n);
+  }
+};
+
+// Function to report the bytes per element of a list of n elements built
+// by push_front, not counting the heap's own per-block overhead
+template <template <typename, typename> class Container, typename T>
+void run_footprint(const Config& config, const char* container, size_t n,
+                   std::vector<Result>& results) {
+  Result r;
+  r.container = container;
+  r.allocator = "counting";
+  r.element = element_name<T>();
+  r.op = "footprint";
+  r.size = n;
+  r.name = r.container + "/" + r.element + "/" + std::to_string(n) + "/" +
+           r.op;
+  if (r.name.find(config.filter) == std::string::npos) {
+    return;
+  }
+
+  std::vector<T> values{make_value<T>(0)};
+  {
+    Container<T, CountingAllocator<T>> list;
+    size_t before = FOOTPRINT_BYTES;
+    prepend_all(list, values, n);
+    r.bytes_per_element =
+        static_cast<double>(FOOTPRINT_BYTES - before) / n;
+  }
+
+  std::printf("%s: [%.2f bytes/element] element: [%zu bytes]\n",
+              r.name.c_str(), r.bytes_per_element, sizeof(T));
+  results.push_back(r);
+}
+
+template <typename T, typename A>
+using Unrolled = UnrolledLinkedList<T, A>;
+
+// Function to pick the sample at quantile q of a sorted vector
+double quantile(const std::vector<double>& sorted, double q) {
+  size_t rank = static_cast<size_t>(q * sorted.size() + 0.999999);
+  return sorted[std::min(sorted.size(), std::max<size_t>(rank, 1)) - 1];
+}
+
+// Function to benchmark one container, element type, size and operation
+template <typename List, typename T>
+void run_benchmark(const Config& config, const char* container,
+                   const char* allocator, size_t n, Op op,
+                   std::vector<Result>& results) {
+  Result r;
+  r.container = container;
+  r.allocator = allocator;
+  r.element = element_name<T>();
+  r.op = op_name(op);
+  r.size = n;
+  r.name = r.container + "/" + r.allocator + "/" + r.element + "/" +
+           std::to_string(n) + "/" + r.op;
+
+  if (!supports<List>(op) ||
+      r.name.find(config.filter) == std::string::npos) {
+    return;
+  }
+  if (op == Op::Copy && sizeof(List) > STACK_COPY_LIMIT) {
+    std::printf("%s: skipped, allocator too large to copy\n", r.name.c_str());
+    return;
+  }
+
+  std::vector<T> values;
+  for (size_t i = 0; i < std::min<size_t>(n, 1024); ++i) {
+    values.push_back(make_value<T>(i));
+  }
+
+  size_t batch =
+      op == Op::Churn ? 1 : std::max<size_t>(1, MIN_ELEMENTS_PER_SAMPLE / n);
+  size_t live = batch * n;
+  size_t elements = op == Op::Churn ? CHURN_OPS : live;
+
+  // One arena for all lists of a sample and their copied or compacted nodes;
+  // a node holds the element and at most two pointers' worth of link and
+  // padding. It is sized for the live elements, like the StackAllocator
+  // arenas, so churn shows whether freed nodes come back.
+  std::unique_ptr<char[]> buffer;
+  std::unique_ptr<StackArena> arena;
+  if constexpr (USES_ARENA<List>) {
+    size_t bytes = 2 * live * (sizeof(T) + 2 * sizeof(void*));
+    buffer.reset(new char[bytes]);
+    arena = std::make_unique<StackArena>(buffer.get(), bytes);
+  }
+
+  std::vector<double> samples;
+  try {
+    for (int i = 0; i < config.warmup; ++i) {
+      run_sample<List>(op, n, batch, values, arena.get());
+    }
+
+    if (PERF != nullptr) {
+      PERF->reset();
+    }
+    double spent = 0;
+    while (static_cast<int>(samples.size()) < config.reps &&
+           (samples.size() < 3 || spent < config.budget)) {
+      uint64_t ns = run_sample<List>(op, n, batch, values, arena.get());
+      samples.push_back(static_cast<double>(ns) / elements);
+      spent += ns / 1e9;
+    }
+  } catch (const std::bad_alloc&) {
+    std::printf("%s: failed, allocator exhausted\n", r.name.c_str());
+    return;
+  }
+
+  std::sort(samples.begin(), samples.end());
+  r.samples = samples.size();
+  r.median_ns = quantile(samples, 0.5);
+  r.p99_ns = quantile(samples, 0.99);
+  if (PERF != nullptr) {
+    double total = static_cast<double>(elements) * samples.size();
+    r.instructions = PERF->instructions() / total;
+    r.cache_misses = PERF->cache_misses() / total;
+  }
+
+  std::printf("%s: median: [%.2f ns/op] p99: [%.2f ns/op] samples: [%zu]",
+              r.name.c_str(), r.median_ns, r.p99_ns, r.samples);
+  if (PERF != nullptr) {
+    std::printf(" instructions: [%.1f/op] cache misses: [%.3f/op]",
+                r.instructions, r.cache_misses);
+  }
+  std::printf("\n");
+  results.push_back(r);
+}
+
+// Function to run every container and operation for one element type and
+// size. StackAllocator arenas get room for twice the elements, since a
+// copied or compacted list allocates behind the nodes it came from.
+// UnrolledLinkedList skips StackAllocator: the arena holds 2N whole nodes of
+// up to 128 bytes.
+template <typename T, size_t N>
+void run_size(const Config& config, std::vector<Result>& results) {
+  using StackAlloc = StackAllocator<T, 2 * N>;
+  using ArenaAlloc = ArenaAllocator<T>;
+  using PoolAlloc = PoolAllocator<T>;
+
+  for (Op op : OPS) {
+    run_benchmark<LinkedList<T, std::allocator<T>>, T>(
+        config, "LinkedList", "std", N, op, results);
+    run_benchmark<LinkedList<T, StackAlloc>, T>(config, "LinkedList", "stack",
+                                                N, op, results);
+    run_benchmark<std::forward_list<T, std::allocator<T>>, T>(
+        config, "forward_list", "std", N, op, results);
+    run_benchmark<std::forward_list<T, StackAlloc>, T>(
+        config, "forward_list", "stack", N, op, results);
+    run_benchmark<LinkedList<T, ArenaAlloc>, T>(config, "LinkedList", "arena",
+                                                N, op, results);
+    run_benchmark<std::forward_list<T, ArenaAlloc>, T>(
+        config, "forward_list", "arena", N, op, results);
+    run_benchmark<LinkedList<T, PoolAlloc>, T>(config, "LinkedList", "pool", N,
+                                               op, results);
+    run_benchmark<std::forward_list<T, PoolAlloc>, T>(
+        config, "forward_list", "pool", N, op, results);
+    run_benchmark<UnrolledLinkedList<T, std::allocator<T>>, T>(
+        config, "UnrolledList", "std", N, op, results);
+    run_benchmark<UnrolledLinkedList<T, ArenaAlloc>, T>(
+        config, "UnrolledList", "arena", N, op, results);
+    run_benchmark<UnrolledLinkedList<T, PoolAlloc>, T>(
+        config, "UnrolledList", "pool", N, op, results);
+  }
+
+  run_footprint<LinkedList, T>(config, "LinkedList", N, results);
+  run_footprint<std::forward_list, T>(config, "forward_list", N, results);
+  run_footprint<Unrolled, T>(config, "UnrolledList", N, results);
+}
+
+template <typename T, size_t... Sizes>
+void run_element(const Config& config, std::vector<Result>& results,
+                 std::index_sequence<Sizes...>) {
+  ((Sizes <= config.max_size ? run_size<T, Sizes>(config, results) : void()),
+   ...);
+}
+
+// Function to write the results as a JSON array
+void write_json(const char* path, const std::vector<Result>& results) {
+  FILE* out = std::fopen(path, "w");
+  if (out == nullptr) {
+    std::perror(path);
+    return;
+  }
+
+  std::fprintf(out, "[\n");
+  for (size_t i = 0; i < results.size(); ++i) {
+    const Result& r = results[i];
+    std::fprintf(out,
+                 "  {\"name\": \"%s\", \"container\": \"%s\", "
+                 "\"allocator\": \"%s\", \"element\": \"%s\", "
+                 "\"size\": %zu, \"op\": \"%s\", \"samples\": %zu, "
+                 "\"median_ns_per_op\": %.3f, \"p99_ns_per_op\": %.3f",
+                 r.name.c_str(), r.container.c_str(), r.allocator.c_str(),
+                 r.element.c_str(), r.size, r.op.c_str(), r.samples,
+                 r.median_ns, r.p99_ns);
+    if (r.bytes_per_element >= 0) {
+      std::fprintf(out, ", \"bytes_per_element\": %.3f",
+                   r.bytes_per_element);
+    }
+    if (r.instructions >= 0) {
+      std::fprintf(out,
+                   ", \"instructions_per_op\": %.2f, "
+                   "\"cache_misses_per_op\": %.4f",
+                   r.instructions, r.cache_misses);
+    }
+    std::fprintf(out, "}%s\n", i + 1 < results.size() ? "," : "");
+  }
+  std::fprintf(out, "]\n");
+  std::fclose(out);
+}
+
+bool parse_args(int argc, char** argv, Config& config) {
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    bool has_value = i + 1 < argc;
+
+    if (arg == "--perf") {
+      config.perf = true;
+    } else if (arg == "--max-size" && has_value) {
+      config.max_size = std::strtoull(argv[++i], nullptr, 10);
+    } else if (arg == "--reps" && has_value) {
+      config.reps = std::max(1, std::atoi(argv[++i]));
+    } else if (arg == "--warmup" && has_value) {
+      config.warmup = std::max(0, std::atoi(argv[++i]));
+    } else if (arg == "--budget" && has_value) {
+      config.budget = std::atof(argv[++i]);
+    } else if (arg == "--filter" && has_value) {
+      config.filter = argv[++i];
+    } else if (arg == "--json" && has_value) {
+      config.json = argv[++i];
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  Config config;
+  if (!parse_args(argc, argv, config)) {
+    std::cerr << "Usage: " << argv[0]
+              << " [--max-size N] [--reps N] [--warmup N] [--budget SEC]"
+                 " [--filter TEXT] [--perf] [--json FILE]\n";
+    return 2;
+  }
+
+  PerfCounters counters;
+  if (config.perf) {
+    if (counters.open()) {
+      PERF = &counters;
+    } else {
+      std::printf("Perf counters unavailable: [%s]\n", std::strerror(errno));
+    }
+  }
+
+  using Sizes = std::index_sequence<10, 100, 1'000, 10'000, 100'000,
+                                    1'000'000, 10'000'000>;
+  std::vector<Result> results;
+  run_element<int>(config, results, Sizes{});
+  run_element<Payload>(config, results, Sizes{});
+  run_element<std::string>(config, results, Sizes{});
+
+  if (config.json != nullptr) {
+    write_json(config.json, results);
+  }
+  return 0;
+}
@@ -0,0 +1,177 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <memory_resource>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "CMallocResource.h"
+#include "LinkedList.h"
+#include "StackArena.h"
+
+// std::pmr containers on the repo's memory resources against the standard
+// ones. Every round builds a fresh resource, fills one container on it and
+// tears both down, the way a request-scoped arena is used:
+//
+//   vector:  push_back of ints, growing from empty
+//   strings: a vector of strings too long for the small string buffer
+//   map:     unordered_map inserts, then erasing every other key
+//   list:    LinkedList with a polymorphic_allocator, push_front then
+//            pop_front of half the nodes
+//
+// Resources: new_delete_resource(), the c_malloc heap, a 64 KB
+// monotonic_buffer_resource, an unsynchronized_pool_resource and a 64 KB
+// StackArena behind an ArenaResource; the buffered ones chain further memory
+// from new_delete_resource(). Each line reports the median of --reps rounds
+// in nanoseconds per element.
+//
+//   pmr_benchmark [--items N] [--reps N]
+
+namespace {
+
+constexpr size_t BUFFER = 64 * 1024;  // Bytes of the buffered resources
+
+// Define a structure for the command line options
+struct Config {
+  size_t items = 10'000;  // Elements per round
+  int reps = 51;          // Measured rounds per workload and resource
+};
+
+const char* const RESOURCES[] = {"new_delete", "cmalloc", "monotonic", "pool",
+                                 "arena"};
+
+// Function to read a monotonic clock in nanoseconds
+uint64_t now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// Function to run 'work' on a fresh resource of the given kind
+template <typename Work>
+size_t with_resource(const std::string& kind, Work&& work) {
+  std::pmr::memory_resource* upstream = std::pmr::new_delete_resource();
+
+  if (kind == "cmalloc") {
+    return work(cmalloc_resource());
+  }
+  if (kind == "monotonic") {
+    alignas(std::max_align_t) char buffer[BUFFER];
+    std::pmr::monotonic_buffer_resource resource(buffer, BUFFER, upstream);
+    return work(&resource);
+  }
+  if (kind == "pool") {
+    std::pmr::unsynchronized_pool_resource resource(upstream);
+    return work(&resource);
+  }
+  if (kind == "arena") {
+    InlineStackArena<BUFFER> arena(upstream);
+    ArenaResource resource(arena);
+    return work(&resource);
+  }
+  return work(upstream);
+}
+
+// Function to grow a vector of ints one element at a time
+size_t fill_vector(std::pmr::memory_resource* resource, size_t items) {
+  std::pmr::vector<int> vector(resource);
+  for (size_t i = 0; i < items; ++i) {
+    vector.push_back(static_cast<int>(i));
+  }
+  return vector.size() + static_cast<size_t>(vector.back());
+}
+
+// Function to fill a vector with strings that each need a block of their own
+size_t fill_strings(std::pmr::memory_resource* resource, size_t items) {
+  std::pmr::vector<std::pmr::string> strings(resource);
+  for (size_t i = 0; i < items; ++i) {
+    strings.emplace_back(40, static_cast<char>('a' + i % 26));
+  }
+  return strings.size() + static_cast<size_t>(strings.back()[0]);
+}
+
+// Function to insert keys into a hash map, then erase every other one
+size_t fill_map(std::pmr::memory_resource* resource, size_t items) {
+  std::pmr::unordered_map<int, int> map(resource);
+  for (size_t i = 0; i < items; ++i) {
+    map.emplace(static_cast<int>(i), static_cast<int>(i));
+  }
+  for (size_t i = 0; i < items; i += 2) {
+    map.erase(static_cast<int>(i));
+  }
+  return map.size();
+}
+
+// Function to push nodes onto a LinkedList, then pop half of them
+size_t fill_list(std::pmr::memory_resource* resource, size_t items) {
+  using Alloc = std::pmr::polymorphic_allocator<int>;
+  LinkedList<int, Alloc> list{Alloc(resource)};
+  for (size_t i = 0; i < items; ++i) {
+    list.push_front(static_cast<int>(i));
+  }
+  for (size_t i = 0; i < items / 2; ++i) {
+    list.pop_front();
+  }
+  return list.size();
+}
+
+// Function to time one workload on every resource and print the medians
+template <typename Fill>
+void run_workload(const char* name, Fill fill, const Config& config) {
+  size_t check = 0;
+  for (const char* kind : RESOURCES) {
+    std::vector<double> samples;
+    for (int rep = 0; rep <= config.reps; ++rep) {
+      uint64_t start = now_ns();
+      check += with_resource(kind, [&](std::pmr::memory_resource* resource) {
+        return fill(resource, config.items);
+      });
+      if (rep > 0) {  // The first round warms up
+        samples.push_back(static_cast<double>(now_ns() - start) /
+                          config.items);
+      }
+    }
+    std::sort(samples.begin(), samples.end());
+    std::printf("%s/%s: [%.1f ns/element]\n", name, kind,
+                samples[samples.size() / 2]);
+  }
+  if (check == 0) {
+    std::printf("Empty workload\n");  // Keeps the results alive
+  }
+}
+
+bool parse_args(int argc, char** argv, Config& config) {
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    bool has_value = i + 1 < argc;
+
+    if (arg == "--items" && has_value) {
+      config.items = std::max<size_t>(2, std::strtoull(argv[++i], nullptr, 10));
+    } else if (arg == "--reps" && has_value) {
+      config.reps = std::max(1, std::atoi(argv[++i]));
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  Config config;
+  if (!parse_args(argc, argv, config)) {
+    std::cerr << "Usage: " << argv[0] << " [--items N] [--reps N]\n";
+    return 2;
+  }
+
+  run_workload("vector", fill_vector, config);
+  run_workload("strings", fill_strings, config);
+  run_workload("map", fill_map, config);
+  run_workload("list", fill_list, config);
+  return 0;
+}
@@ -0,0 +1,175 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ConcurrentPoolAllocator.h"
+#include "LinkedList.h"
+
+// Scaling benchmark for ConcurrentPoolAllocator against std::allocator, with
+// LinkedList nodes over 1 to --max-threads threads:
+//
+//   local:   every thread pushes and pops batches on a list of its own
+//   handoff: every thread builds lists and passes them to the next thread
+//            in a ring, which frees them, so nodes change threads
+//
+// Each line reports node allocations and frees per second over all threads,
+// and the speedup over the same workload on one thread.
+//
+//   pool_benchmark [--max-threads N] [--ops N]
+
+namespace {
+
+constexpr size_t BATCH = 64;  // Nodes per push/pop batch or handed-off list
+
+// Define a structure for the command line options
+struct Config {
+  size_t max_threads = 8;
+  size_t ops = 2'000'000;  // Node allocations per thread
+};
+
+// Function to push and pop batches of nodes on one list
+template <typename Alloc>
+void run_local(size_t ops) {
+  LinkedList<int, Alloc> list;
+  for (size_t done = 0; done < ops; done += BATCH) {
+    for (size_t i = 0; i < BATCH; ++i) {
+      list.push_front(static_cast<int>(i));
+    }
+    for (size_t i = 0; i < BATCH; ++i) {
+      list.pop_front();
+    }
+  }
+}
+
+// Define a structure for the lists waiting for one thread of the ring
+template <typename List>
+struct Mailbox {
+  std::mutex lock;
+  std::vector<List*> lists;
+};
+
+// Function to build lists for the next thread and free the ones sent by the
+// previous thread, until both sides are done
+template <typename List>
+void run_handoff(size_t ops, Mailbox<List>& mine, Mailbox<List>& next) {
+  size_t lists = ops / BATCH;
+  size_t received = 0;
+
+  for (size_t i = 0; i < lists || received < lists; ++i) {
+    if (i < lists) {
+      List* list = new List;
+      for (size_t n = 0; n < BATCH; ++n) {
+        list->push_front(static_cast<int>(n));
+      }
+      std::lock_guard<std::mutex> guard(next.lock);
+      next.lists.push_back(list);
+    }
+
+    std::vector<List*> incoming;
+    {
+      std::lock_guard<std::mutex> guard(mine.lock);
+      incoming.swap(mine.lists);
+    }
+    for (List* list : incoming) {
+      delete list;
+    }
+    received += incoming.size();
+    if (incoming.empty() && i >= lists) {
+      std::this_thread::yield();
+    }
+  }
+}
+
+// Function to run one workload on 'threads' threads and return node
+// operations per second
+template <typename Alloc>
+double run_workload(const char* workload, size_t threads, size_t ops) {
+  using List = LinkedList<int, Alloc>;
+  std::vector<Mailbox<List>> mailboxes(threads);
+  std::atomic<bool> go{false};
+
+  auto worker = [&](size_t id) {
+    while (!go.load(std::memory_order_acquire)) {
+      std::this_thread::yield();
+    }
+    if (std::strcmp(workload, "local") == 0) {
+      run_local<Alloc>(ops);
+    } else {
+      run_handoff<List>(ops, mailboxes[id], mailboxes[(id + 1) % threads]);
+    }
+  };
+
+  std::vector<std::thread> pool;
+  for (size_t id = 0; id < threads; ++id) {
+    pool.emplace_back(worker, id);
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  go.store(true, std::memory_order_release);
+  for (std::thread& thread : pool) {
+    thread.join();
+  }
+  auto end = std::chrono::steady_clock::now();
+
+  double seconds = std::chrono::duration<double>(end - start).count();
+  return 2.0 * threads * ops / seconds;  // One allocation and one free each
+}
+
+// Function to run one workload and allocator over all thread counts
+template <typename Alloc>
+void run_scaling(const Config& config, const char* workload,
+                 const char* allocator) {
+  double single = 0;
+  for (size_t threads = 1; threads <= config.max_threads; threads *= 2) {
+    double rate = run_workload<Alloc>(workload, threads, config.ops);
+    if (threads == 1) {
+      single = rate;
+    }
+    std::printf("%s/%s/%zu threads: [%.1f Mops/s] speedup: [%.2fx]\n",
+                workload, allocator, threads, rate / 1e6, rate / single);
+  }
+}
+
+bool parse_args(int argc, char** argv, Config& config) {
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    bool has_value = i + 1 < argc;
+
+    if (arg == "--max-threads" && has_value) {
+      config.max_threads =
+          std::max<size_t>(1, std::strtoull(argv[++i], nullptr, 10));
+    } else if (arg == "--ops" && has_value) {
+      config.ops =
+          std::max<size_t>(BATCH, std::strtoull(argv[++i], nullptr, 10));
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  Config config;
+  if (!parse_args(argc, argv, config)) {
+    std::cerr << "Usage: " << argv[0] << " [--max-threads N] [--ops N]\n";
+    return 2;
+  }
+
+  std::printf("Hardware threads: [%u]\n", std::thread::hardware_concurrency());
+  for (const char* workload : {"local", "handoff"}) {
+    run_scaling<std::allocator<int>>(config, workload, "std");
+    run_scaling<ConcurrentPoolAllocator<int>>(config, workload, "pool");
+  }
+  return 0;
+}
@@ -0,0 +1,125 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ConcurrentPoolAllocator.h"
+#include "MpscQueue.h"
+
+// Throughput and latency of MpscQueue with 1 to --max-producers producer
+// threads and one consumer, with nodes from std::allocator and from
+// ConcurrentPoolAllocator. Every element carries its push time; the consumer
+// records how long it waited in the queue.
+//
+//   queue_benchmark [--max-producers N] [--items N]
+
+namespace {
+
+// Define a structure for the command line options
+struct Config {
+  size_t max_producers = 8;
+  size_t items = 1'000'000;  // Elements per producer
+};
+
+// Define a structure for one queue element
+struct Item {
+  uint64_t pushed_ns;  // Clock reading at push time
+  uint64_t producer;
+};
+
+// Function to read a monotonic clock in nanoseconds
+uint64_t now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// Function to run one configuration and print its results
+template <typename Alloc>
+void run_queue(const char* allocator, size_t producers, size_t items) {
+  MpscQueue<Item, Alloc> queue;
+  std::atomic<bool> go{false};
+  std::vector<std::thread> threads;
+
+  for (size_t id = 0; id < producers; ++id) {
+    threads.emplace_back([&, id] {
+      while (!go.load(std::memory_order_acquire)) {
+        std::this_thread::yield();
+      }
+      for (size_t i = 0; i < items; ++i) {
+        queue.push(Item{now_ns(), id});
+      }
+    });
+  }
+
+  size_t total = producers * items;
+  std::vector<uint32_t> latencies;
+  latencies.reserve(total);
+
+  uint64_t start = now_ns();
+  go.store(true, std::memory_order_release);
+  Item item;
+  while (latencies.size() < total) {
+    if (!queue.try_pop(item)) {
+      std::this_thread::yield();
+      continue;
+    }
+    latencies.push_back(static_cast<uint32_t>(
+        std::min<uint64_t>(now_ns() - item.pushed_ns, UINT32_MAX)));
+  }
+  uint64_t elapsed = now_ns() - start;
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+
+  std::sort(latencies.begin(), latencies.end());
+  auto percentile = [&](double p) {
+    return latencies[static_cast<size_t>(p * (latencies.size() - 1))];
+  };
+  std::printf("%s/%zu producers: throughput: [%.2f Mitems/s] latency ns "
+              "p50: [%u] p99: [%u] p99.9: [%u]\n",
+              allocator, producers, 1e3 * total / elapsed, percentile(0.5),
+              percentile(0.99), percentile(0.999));
+}
+
+bool parse_args(int argc, char** argv, Config& config) {
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    bool has_value = i + 1 < argc;
+
+    if (arg == "--max-producers" && has_value) {
+      config.max_producers =
+          std::max<size_t>(1, std::strtoull(argv[++i], nullptr, 10));
+    } else if (arg == "--items" && has_value) {
+      config.items = std::max<size_t>(1, std::strtoull(argv[++i], nullptr, 10));
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  Config config;
+  if (!parse_args(argc, argv, config)) {
+    std::cerr << "Usage: " << argv[0] << " [--max-producers N] [--items N]\n";
+    return 2;
+  }
+
+  std::printf("Hardware threads: [%u]\n", std::thread::hardware_concurrency());
+  for (size_t producers = 1; producers <= config.max_producers;
+       producers *= 2) {
+    run_queue<std::allocator<Item>>("std", producers, config.items);
+    run_queue<ConcurrentPoolAllocator<Item>>("pool", producers, config.items);
+  }
+  return 0;
+}
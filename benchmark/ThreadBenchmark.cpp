@@ -0,0 +1,492 @@
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <memory_resource>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ConcurrentPoolAllocator.h"
+#include "MallocImplementation.h"
+#include "StackArena.h"
+
+// Multi-threaded allocator workloads, each over 1 to --max-threads threads:
+//
+//   threadtest:    every thread allocates batches of 64-byte blocks and
+//                  frees them again, touching nothing shared
+//   larson:        server simulation; threads replace random blocks of 8 to
+//                  64 bytes in their slot arrays, then exit and hand the
+//                  arrays to fresh threads, which free what others allocated
+//   prodcons:      threads in a ring allocate blocks for the next thread
+//                  through a single-producer queue and free the blocks the
+//                  previous thread sent them
+//   cache-scratch: every thread gets and frees a block the main thread
+//                  allocated, then keeps allocating and writing small
+//                  blocks; an allocator that hands neighboring bytes to
+//                  different threads makes them share cache lines
+//
+// Allocators: glibc malloc, c_malloc, ConcurrentSlotPool (the pool behind
+// ConcurrentPoolAllocator and its LinkedList nodes) with 64-byte slots, and
+// a StackArena per thread for the workloads that free on the allocating
+// thread in LIFO order. Every run happens in a child process of its own, so
+// the peak RSS of one does not leak into the next. Each line reports
+// allocations and frees per second over all threads, the speedup over one
+// thread and the RSS growth; --json writes the same numbers, tagged with
+// --label, to compare commits.
+//
+//   thread_benchmark [--max-threads N] [--ops N] [--filter TEXT]
+//                    [--json FILE] [--label TEXT]
+
+namespace {
+
+constexpr size_t BLOCK = 64;            // Largest block of every workload
+constexpr size_t BATCH = 1000;          // Blocks per threadtest batch
+constexpr size_t LARSON_SLOTS = 1000;   // Live blocks per larson thread
+constexpr size_t LARSON_ROUNDS = 10;    // Thread generations in larson
+constexpr size_t RING = 1024;           // Queue slots between two threads
+constexpr size_t SCRATCH_SIZE = 8;      // Block size of cache-scratch
+constexpr int SCRATCH_WRITES = 100;     // Writes to every scratch block
+constexpr size_t ARENA_BYTES = 1 << 20; // Buffer of each thread's arena
+
+// Define a structure for the command line options
+struct Config {
+  size_t max_threads = 8;
+  size_t ops = 1'000'000;      // Allocations per thread
+  std::string filter;          // Only runs whose name contains it
+  const char* json = nullptr;  // Write the results here
+  std::string label;           // Tag of the results, such as a commit
+};
+
+// Define a structure for one benchmark result
+struct Result {
+  std::string workload;
+  std::string allocator;
+  size_t threads = 0;
+  double ops_per_sec = 0;   // Allocations and frees over all threads
+  double speedup = 0;       // Against the same run on one thread
+  size_t peak_rss = 0;      // Bytes
+  size_t rss_growth = 0;    // Peak RSS over the RSS before the run
+};
+
+// Define a structure for an allocator under test
+struct ThreadAllocator {
+  const char* name;
+  void* (*allocate)(size_t size);
+  void (*release)(void* ptr, size_t size);
+  bool cross_thread;  // Blocks may be freed by another thread
+};
+
+void* glibc_allocate(size_t size) { return std::malloc(size); }
+void glibc_release(void* ptr, size_t) { std::free(ptr); }
+
+void* cmalloc_allocate(size_t size) { return c_malloc(size); }
+void cmalloc_release(void* ptr, size_t) { c_free(ptr); }
+
+using SlotPool = ConcurrentSlotPool<BLOCK>;
+
+void* pool_allocate(size_t) { return SlotPool::instance().allocate(); }
+void pool_release(void* ptr, size_t) { SlotPool::instance().deallocate(ptr); }
+
+// Define a structure for the arena of one thread, chaining blocks from
+// new_delete_resource() when its buffer runs out
+struct ThreadArena {
+  std::unique_ptr<char[]> buffer{new char[ARENA_BYTES]};
+  StackArena arena{buffer.get(), ARENA_BYTES,
+                   std::pmr::new_delete_resource()};
+};
+
+// Function to get the calling thread's arena
+StackArena& thread_arena() {
+  static thread_local ThreadArena arena;
+  return arena.arena;
+}
+
+void* arena_allocate(size_t size) {
+  return thread_arena().allocate(size, alignof(std::max_align_t));
+}
+
+// Frees of another thread's blocks never match the top, so they are no-ops
+void arena_release(void* ptr, size_t size) {
+  thread_arena().deallocate(ptr, size);
+}
+
+const ThreadAllocator ALLOCATORS[] = {
+    {"glibc", glibc_allocate, glibc_release, true},
+    {"c_malloc", cmalloc_allocate, cmalloc_release, true},
+    {"pool", pool_allocate, pool_release, true},
+    {"arena", arena_allocate, arena_release, false},
+};
+
+// Define a structure for a bounded single-producer, single-consumer queue
+// of blocks between two neighbors of the ring
+struct alignas(64) Ring {
+  alignas(64) std::atomic<size_t> head{0};  // Next slot to read
+  alignas(64) std::atomic<size_t> tail{0};  // Next slot to write
+  void* slots[RING];
+
+  bool push(void* p) {
+    size_t tail_now = tail.load(std::memory_order_relaxed);
+    if (tail_now - head.load(std::memory_order_acquire) == RING) {
+      return false;
+    }
+    slots[tail_now % RING] = p;
+    tail.store(tail_now + 1, std::memory_order_release);
+    return true;
+  }
+
+  void* pop() {
+    size_t head_now = head.load(std::memory_order_relaxed);
+    if (head_now == tail.load(std::memory_order_acquire)) {
+      return nullptr;
+    }
+    void* p = slots[head_now % RING];
+    head.store(head_now + 1, std::memory_order_release);
+    return p;
+  }
+};
+
+// Function to advance a xorshift generator
+uint32_t next_random(uint32_t& state) {
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  return state;
+}
+
+// Function to write to a new block, as its owner would
+void touch(void* p, size_t size) {
+  static_cast<volatile char*>(p)[0] = 1;
+  static_cast<volatile char*>(p)[size - 1] = 1;
+}
+
+// Function to run 'threads' copies of 'work(id)' from a common start and
+// return the seconds until all of them finished
+template <typename Work>
+double run_threads(size_t threads, Work work) {
+  std::atomic<bool> go{false};
+  std::vector<std::thread> pool;
+  for (size_t id = 0; id < threads; ++id) {
+    pool.emplace_back([&, id] {
+      while (!go.load(std::memory_order_acquire)) {
+        std::this_thread::yield();
+      }
+      work(id);
+    });
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  go.store(true, std::memory_order_release);
+  for (std::thread& thread : pool) {
+    thread.join();
+  }
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double>(end - start).count();
+}
+
+// Function to allocate batches of blocks and free them in reverse order
+double run_threadtest(const ThreadAllocator& alloc, size_t threads,
+                      size_t ops) {
+  return run_threads(threads, [&](size_t) {
+    std::vector<void*> blocks(BATCH);
+    for (size_t done = 0; done < ops; done += BATCH) {
+      for (size_t i = 0; i < BATCH; ++i) {
+        blocks[i] = alloc.allocate(BLOCK);
+        touch(blocks[i], BLOCK);
+      }
+      for (size_t i = BATCH; i-- > 0;) {
+        alloc.release(blocks[i], BLOCK);
+      }
+    }
+  });
+}
+
+// Function to replace random blocks of every thread's slots, with a fresh
+// generation of threads taking over the slots of the last one each round
+double run_larson(const ThreadAllocator& alloc, size_t threads, size_t ops) {
+  struct Slot {
+    void* ptr;
+    size_t size;
+  };
+  std::vector<std::vector<Slot>> slots(threads,
+                                       std::vector<Slot>(LARSON_SLOTS));
+  uint32_t seed = 12345;
+  for (auto& thread_slots : slots) {
+    for (Slot& slot : thread_slots) {
+      slot.size = 8 + next_random(seed) % (BLOCK - 7);
+      slot.ptr = alloc.allocate(slot.size);
+    }
+  }
+
+  double seconds = 0;
+  size_t per_round = ops / LARSON_ROUNDS;
+  for (size_t round = 0; round < LARSON_ROUNDS; ++round) {
+    seconds += run_threads(threads, [&](size_t id) {
+      auto& mine = slots[(id + round) % threads];
+      uint32_t state = static_cast<uint32_t>(2654435761u * (id + round + 1));
+      for (size_t i = 0; i < per_round; ++i) {
+        Slot& slot = mine[next_random(state) % LARSON_SLOTS];
+        alloc.release(slot.ptr, slot.size);
+        slot.size = 8 + next_random(state) % (BLOCK - 7);
+        slot.ptr = alloc.allocate(slot.size);
+        touch(slot.ptr, slot.size);
+      }
+    });
+  }
+
+  for (auto& thread_slots : slots) {
+    for (Slot& slot : thread_slots) {
+      alloc.release(slot.ptr, slot.size);
+    }
+  }
+  return seconds;
+}
+
+// Function to pass blocks around a ring of threads, each freeing what its
+// predecessor allocated
+double run_prodcons(const ThreadAllocator& alloc, size_t threads,
+                    size_t ops) {
+  std::unique_ptr<Ring[]> rings(new Ring[threads]);
+  return run_threads(threads, [&](size_t id) {
+    Ring& next = rings[(id + 1) % threads];
+    Ring& mine = rings[id];
+    size_t produced = 0;
+    size_t consumed = 0;
+    void* pending = nullptr;
+
+    while (produced < ops || consumed < ops) {
+      bool progress = false;
+      if (produced < ops) {
+        if (pending == nullptr) {
+          pending = alloc.allocate(BLOCK);
+          touch(pending, BLOCK);
+        }
+        if (next.push(pending)) {
+          pending = nullptr;
+          ++produced;
+          progress = true;
+        }
+      }
+      for (void* p; (p = mine.pop()) != nullptr; ++consumed) {
+        alloc.release(p, BLOCK);
+        progress = true;
+      }
+      if (!progress) {
+        std::this_thread::yield();
+      }
+    }
+  });
+}
+
+// Function to check for false sharing: each thread frees a neighbor of the
+// other threads' first blocks, then allocates and writes to small blocks
+double run_cache_scratch(const ThreadAllocator& alloc, size_t threads,
+                         size_t ops) {
+  std::vector<void*> handed(threads);
+  for (void*& p : handed) {
+    p = alloc.allocate(SCRATCH_SIZE);
+  }
+
+  return run_threads(threads, [&](size_t id) {
+    alloc.release(handed[id], SCRATCH_SIZE);
+    for (size_t i = 0; i < ops; ++i) {
+      auto* p = static_cast<volatile char*>(alloc.allocate(SCRATCH_SIZE));
+      for (int w = 0; w < SCRATCH_WRITES; ++w) {
+        p[w % SCRATCH_SIZE] = static_cast<char>(p[w % SCRATCH_SIZE] + 1);
+      }
+      alloc.release(const_cast<char*>(p), SCRATCH_SIZE);
+    }
+  });
+}
+
+// Define a structure for a workload, which makes 'ops' allocations per
+// thread and returns the seconds they took
+struct Workload {
+  const char* name;
+  double (*run)(const ThreadAllocator& alloc, size_t threads, size_t ops);
+  bool cross_thread;    // Frees blocks on threads that did not allocate them
+  size_t ops_divisor;   // Runs with --ops / ops_divisor allocations
+};
+
+// Scratch blocks take many writes each, so they get fewer allocations
+const Workload WORKLOADS[] = {
+    {"threadtest", run_threadtest, false, 1},
+    {"larson", run_larson, true, 1},
+    {"prodcons", run_prodcons, true, 1},
+    {"cache-scratch", run_cache_scratch, true, SCRATCH_WRITES / 10},
+};
+
+// Function to read a "Vm...: <n> kB" line of /proc/self/status, in bytes
+size_t proc_status_bytes(const char* field) {
+  std::ifstream status("/proc/self/status");
+  std::string line;
+  size_t length = std::strlen(field);
+
+  while (std::getline(status, line)) {
+    if (line.compare(0, length, field) == 0 && line[length] == ':') {
+      return std::strtoull(line.c_str() + length + 1, nullptr, 10) * 1024;
+    }
+  }
+  return 0;
+}
+
+// Function to run one workload in a child process and collect its result
+bool measure(const Workload& workload, const ThreadAllocator& alloc,
+             size_t threads, size_t ops, Result& result) {
+  int fds[2];
+  if (pipe(fds) != 0) {
+    return false;
+  }
+
+  std::fflush(stdout);
+  pid_t child = fork();
+  if (child == 0) {
+    close(fds[0]);
+    // Restart the peak RSS count at what the child inherited
+    std::ofstream("/proc/self/clear_refs") << "5";
+    size_t baseline = proc_status_bytes("VmRSS");
+
+    size_t allocations = ops / workload.ops_divisor;
+    double seconds = workload.run(alloc, threads, allocations);
+    double measured[3] = {
+        2.0 * threads * allocations / seconds,
+        static_cast<double>(proc_status_bytes("VmHWM")),
+        static_cast<double>(baseline),
+    };
+    ssize_t written = write(fds[1], measured, sizeof(measured));
+    _exit(written == sizeof(measured) ? 0 : 1);
+  }
+
+  close(fds[1]);
+  double measured[3];
+  ssize_t n = read(fds[0], measured, sizeof(measured));
+  close(fds[0]);
+  int status = 0;
+  waitpid(child, &status, 0);
+  if (n != sizeof(measured) || !WIFEXITED(status) ||
+      WEXITSTATUS(status) != 0) {
+    return false;
+  }
+
+  result.ops_per_sec = measured[0];
+  result.peak_rss = static_cast<size_t>(measured[1]);
+  result.rss_growth = measured[1] > measured[2]
+                          ? static_cast<size_t>(measured[1] - measured[2])
+                          : 0;
+  return true;
+}
+
+// Function to write the results as a JSON object
+void write_json(const Config& config, const std::vector<Result>& results) {
+  FILE* out = std::fopen(config.json, "w");
+  if (out == nullptr) {
+    std::perror(config.json);
+    return;
+  }
+
+  std::fprintf(out,
+               "{\n  \"label\": \"%s\",\n  \"hardware_threads\": %u,\n"
+               "  \"ops_per_thread\": %zu,\n  \"results\": [\n",
+               config.label.c_str(), std::thread::hardware_concurrency(),
+               config.ops);
+  for (size_t i = 0; i < results.size(); ++i) {
+    const Result& r = results[i];
+    std::fprintf(out,
+                 "    {\"workload\": \"%s\", \"allocator\": \"%s\", "
+                 "\"threads\": %zu, \"ops_per_sec\": %.0f, "
+                 "\"speedup\": %.3f, \"peak_rss_kb\": %zu, "
+                 "\"rss_growth_kb\": %zu}%s\n",
+                 r.workload.c_str(), r.allocator.c_str(), r.threads,
+                 r.ops_per_sec, r.speedup, r.peak_rss / 1024,
+                 r.rss_growth / 1024, i + 1 < results.size() ? "," : "");
+  }
+  std::fprintf(out, "  ]\n}\n");
+  std::fclose(out);
+}
+
+bool parse_args(int argc, char** argv, Config& config) {
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    bool has_value = i + 1 < argc;
+
+    if (arg == "--max-threads" && has_value) {
+      config.max_threads =
+          std::max<size_t>(1, std::strtoull(argv[++i], nullptr, 10));
+    } else if (arg == "--ops" && has_value) {
+      config.ops = std::max<size_t>(
+          BATCH * LARSON_ROUNDS, std::strtoull(argv[++i], nullptr, 10));
+      config.ops -= config.ops % (BATCH * LARSON_ROUNDS);
+    } else if (arg == "--filter" && has_value) {
+      config.filter = argv[++i];
+    } else if (arg == "--json" && has_value) {
+      config.json = argv[++i];
+    } else if (arg == "--label" && has_value) {
+      config.label = argv[++i];
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  Config config;
+  if (!parse_args(argc, argv, config)) {
+    std::cerr << "Usage: " << argv[0]
+              << " [--max-threads N] [--ops N] [--filter TEXT]"
+                 " [--json FILE] [--label TEXT]\n";
+    return 2;
+  }
+
+  std::printf("Hardware threads: [%u]\n", std::thread::hardware_concurrency());
+  std::vector<Result> results;
+  for (const Workload& workload : WORKLOADS) {
+    for (const ThreadAllocator& alloc : ALLOCATORS) {
+      std::string name = std::string(workload.name) + "/" + alloc.name;
+      if (workload.cross_thread && !alloc.cross_thread) {
+        continue;
+      }
+      if (name.find(config.filter) == std::string::npos) {
+        continue;
+      }
+
+      double single = 0;
+      for (size_t threads = 1; threads <= config.max_threads; threads *= 2) {
+        Result result;
+        result.workload = workload.name;
+        result.allocator = alloc.name;
+        result.threads = threads;
+        if (!measure(workload, alloc, threads, config.ops, result)) {
+          std::printf("%s/%zu threads: run crashed\n", name.c_str(), threads);
+          continue;
+        }
+        if (threads == 1) {
+          single = result.ops_per_sec;
+        }
+        result.speedup = single != 0 ? result.ops_per_sec / single : 0;
+        std::printf("%s/%zu threads: [%.1f Mops/s] speedup: [%.2fx] "
+                    "peak RSS: [%zu KB] growth: [%zu KB]\n",
+                    name.c_str(), threads, result.ops_per_sec / 1e6,
+                    result.speedup, result.peak_rss / 1024,
+                    result.rss_growth / 1024);
+        results.push_back(result);
+      }
+    }
+  }
+
+  if (config.json != nullptr) {
+    write_json(config, results);
+  }
+  return 0;
+}
@@ -0,0 +1,40 @@
+#ifndef CMALLOC_RESOURCE_H
+#define CMALLOC_RESOURCE_H
+
+#include <cstddef>
+#include <memory_resource>
+#include <new>
+
+#include "MallocImplementation.h"
+
+// std::pmr::memory_resource over the c_malloc heap, for std::pmr containers
+// and as the upstream of other resources. Every instance serves the same
+// heap, so all of them compare equal and memory may be freed through any.
+class CMallocResource : public std::pmr::memory_resource {
+ private:
+  void* do_allocate(size_t bytes, size_t alignment) override {
+    // Plain c_malloc() pointers already suit every fundamental type
+    void* p = alignment <= alignof(std::max_align_t)
+                  ? c_malloc(bytes)
+                  : c_aligned_alloc(alignment, bytes);
+    if (p == nullptr) {
+      throw std::bad_alloc();
+    }
+    return p;
+  }
+
+  void do_deallocate(void* p, size_t, size_t) override { c_free(p); }
+
+  bool do_is_equal(const memory_resource& other) const noexcept override {
+    return dynamic_cast<const CMallocResource*>(&other) != nullptr;
+  }
+};
+
+// Function to get the process-wide c_malloc resource, in the manner of
+// std::pmr::new_delete_resource()
+inline std::pmr::memory_resource* cmalloc_resource() noexcept {
+  static CMallocResource resource;
+  return &resource;
+}
+
+#endif  // CMALLOC_RESOURCE_H
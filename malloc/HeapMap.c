@@ -0,0 +1,265 @@
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "HeapMap.h"
+#include "HeapProfile.h"
+#include "MallocImplementation.h"
+
+// Heap map for the c_malloc heap: fragmentation numbers and a page-by-page
+// occupancy map, from one walk over all chunks and blocks. Each page of a
+// chunk becomes one character of its map:
+//
+//   '#'       every byte belongs to an allocated block or chunk metadata
+//   '1'..'9'  partly allocated, in ninths rounded up
+//   '.'       all free, still committed
+//   '-'       all free, given back to the OS
+//
+// The map is written while the walk runs, so the heap stays locked for the
+// whole write(); it is meant for diagnostics, not for hot paths.
+
+#define PAGES_BUFFER 256  // Page characters collected per output_printf()
+
+// Define a structure for the state of a heap walk
+typedef struct {
+  CMallocHeapInfo* info;
+  Output* out;                // NULL when only the numbers are wanted
+  int chunks;                 // Chunks written so far
+  uintptr_t page;             // Page being counted
+  uintptr_t chunk_end;        // End of the current chunk
+  size_t page_free;           // Free bytes of the current page
+  size_t page_released;       // Released bytes of the current page
+  size_t chunk_free;          // Free bytes of the current chunk
+  size_t pending;             // Characters in 'pages'
+  char pages[PAGES_BUFFER];
+} MapWalk;
+
+// Serializes the walks, whose state is too large for small thread stacks
+static pthread_mutex_t MAP_LOCK = PTHREAD_MUTEX_INITIALIZER;
+static MapWalk WALK;
+
+// Function to add the bytes of [start, end) that fall in [from, to)
+static size_t overlap(uintptr_t start, uintptr_t end, uintptr_t from,
+                      uintptr_t to) {
+  uintptr_t low = start > from ? start : from;
+  uintptr_t high = end < to ? end : to;
+  return high > low ? high - low : 0;
+}
+
+// Function to write out the collected page characters
+static void flush_pages(MapWalk* w) {
+  if (w->pending > 0) {
+    output_printf(w->out, "%.*s", (int)w->pending, w->pages);
+    w->pending = 0;
+  }
+}
+
+// Function to finish the current page and move on to the next one
+static void next_page(MapWalk* w) {
+  char c;
+  if (w->page_released == MAP_PAGE) {
+    c = '-';
+  } else if (w->page_free == MAP_PAGE) {
+    c = '.';
+  } else if (w->page_free == 0) {
+    c = '#';
+  } else {
+    c = (char)('1' + ((MAP_PAGE - w->page_free) * 9 - 1) / MAP_PAGE);
+  }
+
+  w->pages[w->pending++] = c;
+  if (w->pending == PAGES_BUFFER) {
+    flush_pages(w);
+  }
+  w->page += MAP_PAGE;
+  w->page_free = 0;
+  w->page_released = 0;
+}
+
+// Function to finish all pages below 'address'
+static void finish_pages(MapWalk* w, uintptr_t address) {
+  while (w->page < address) {
+    next_page(w);
+  }
+}
+
+// Function to finish the map of the current chunk, if any
+static void finish_chunk(MapWalk* w) {
+  if (w->out == NULL || w->chunks == 0) {
+    return;
+  }
+  finish_pages(w, w->chunk_end);
+  flush_pages(w);
+  output_printf(w->out, "\", \"free_bytes\": %zu}", w->chunk_free);
+}
+
+// Function to count the free bytes of a block page by page
+static void map_free(MapWalk* w, const HeapSpan* span) {
+  uintptr_t start = span->start;
+  uintptr_t end = span->start + span->size;
+  uintptr_t released_end = span->released + span->released_size;
+
+  while (start < end) {
+    uintptr_t page = start & ~(uintptr_t)(MAP_PAGE - 1);
+    finish_pages(w, page);
+    uintptr_t stop = end < page + MAP_PAGE ? end : page + MAP_PAGE;
+    w->page_free += stop - start;
+    w->page_released += overlap(start, stop, span->released, released_end);
+    start = stop;
+  }
+}
+
+// Function to account one span of a heap walk
+static void visit_span(const HeapSpan* span, void* arg) {
+  MapWalk* w = arg;
+  CMallocHeapInfo* info = w->info;
+
+  if (span->kind == SPAN_CHUNK) {
+    ++info->chunks;
+    info->heap_mapped += span->size;
+    if (w->out != NULL) {
+      finish_chunk(w);
+      output_printf(w->out, "%s\n    {\"address\": \"%#lx\", \"size\": %zu, "
+                    "\"pages\": \"", w->chunks != 0 ? "," : "",
+                    (unsigned long)span->start, span->size);
+    }
+    ++w->chunks;
+    w->page = span->start;
+    w->chunk_end = span->start + span->size;
+    w->chunk_free = 0;
+    return;
+  }
+
+  CMallocSizeClass* size_class = &info->classes[span->size_class];
+  if (span->kind == SPAN_USED) {
+    ++size_class->used_blocks;
+    size_class->used_bytes += span->size;
+    info->used_bytes += span->size;
+    return;
+  }
+
+  ++size_class->free_blocks;
+  size_class->free_bytes += span->size;
+  ++info->free_blocks;
+  info->free_bytes += span->size;
+  info->released_bytes += span->released_size;
+  if (span->size > info->largest_free_block) {
+    info->largest_free_block = span->size;
+  }
+  int bucket = 63 - __builtin_clzll(span->size);
+  if (bucket >= C_MALLOC_HISTOGRAM_BUCKETS) {
+    bucket = C_MALLOC_HISTOGRAM_BUCKETS - 1;
+  }
+  ++info->free_histogram[bucket];
+
+  w->chunk_free += span->size;
+  if (w->out != NULL) {
+    map_free(w, span);
+  }
+}
+
+// Function to walk the heap, writing the page map to 'out' unless it is
+// NULL. The caller must hold MAP_LOCK.
+static void walk_heap(CMallocHeapInfo* info, Output* out) {
+  memset(info, 0, sizeof(*info));
+  memset(&WALK, 0, sizeof(WALK));
+  WALK.info = info;
+  WALK.out = out;
+
+  heap_walk(visit_span, &WALK);
+  finish_chunk(&WALK);
+
+  for (int i = 0; i < C_MALLOC_SIZE_CLASSES; ++i) {
+    info->classes[i].min_size = heap_class_size(i);
+  }
+  if (info->free_bytes != 0) {
+    info->fragmentation =
+        1.0 - (double)info->largest_free_block / (double)info->free_bytes;
+  }
+}
+
+// Function to walk the central heap and describe its fragmentation
+void c_malloc_heap_info(CMallocHeapInfo* info) {
+  pthread_mutex_lock(&MAP_LOCK);
+  walk_heap(info, NULL);
+  pthread_mutex_unlock(&MAP_LOCK);
+}
+
+// Function to write the heap numbers that follow the chunk maps
+static void write_summary(Output* out, const CMallocHeapInfo* info) {
+  output_printf(out,
+                "\n  ],\n"
+                "  \"heap_mapped\": %zu,\n"
+                "  \"used_bytes\": %zu,\n"
+                "  \"free_bytes\": %zu,\n"
+                "  \"free_blocks\": %zu,\n"
+                "  \"largest_free_block\": %zu,\n"
+                "  \"released_bytes\": %zu,\n"
+                "  \"fragmentation\": %.4f,\n"
+                "  \"free_histogram\": [",
+                info->heap_mapped, info->used_bytes, info->free_bytes,
+                info->free_blocks, info->largest_free_block,
+                info->released_bytes, info->fragmentation);
+
+  int first = 1;
+  for (int i = 0; i < C_MALLOC_HISTOGRAM_BUCKETS; ++i) {
+    if (info->free_histogram[i] != 0) {
+      output_printf(out, "%s\n    {\"min_size\": %zu, \"blocks\": %zu}",
+                    first ? "" : ",", (size_t)1 << i,
+                    info->free_histogram[i]);
+      first = 0;
+    }
+  }
+
+  output_printf(out, "\n  ],\n  \"size_classes\": [");
+  first = 1;
+  for (int i = 0; i < C_MALLOC_SIZE_CLASSES; ++i) {
+    const CMallocSizeClass* c = &info->classes[i];
+    if (c->used_blocks != 0 || c->free_blocks != 0) {
+      output_printf(out,
+                    "%s\n    {\"class\": %d, \"min_size\": %zu, "
+                    "\"used_blocks\": %zu, \"used_bytes\": %zu, "
+                    "\"free_blocks\": %zu, \"free_bytes\": %zu}",
+                    first ? "" : ",", i, c->min_size, c->used_blocks,
+                    c->used_bytes, c->free_blocks, c->free_bytes);
+      first = 0;
+    }
+  }
+  output_printf(out, "\n  ]\n}\n");
+}
+
+// Function to write the layout of the central heap as JSON to a file
+// descriptor. Returns 0 on success.
+int c_malloc_heap_map_write(int fd) {
+  static Output out;  // Under MAP_LOCK, like the walk
+  static CMallocHeapInfo info;
+
+  pthread_mutex_lock(&MAP_LOCK);
+  out.fd = fd;
+  out.used = 0;
+  out.failed = 0;
+
+  output_printf(&out, "{\n  \"page_size\": %d,\n  \"chunks\": [", MAP_PAGE);
+  walk_heap(&info, &out);
+  write_summary(&out, &info);
+  output_flush(&out);
+  int result = out.failed ? -1 : 0;
+  pthread_mutex_unlock(&MAP_LOCK);
+
+  return result;
+}
+
+// Function to write the layout of the central heap as JSON to a file
+int c_malloc_heap_map_dump(const char* path) {
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    return -1;
+  }
+  int result = c_malloc_heap_map_write(fd);
+  close(fd);
+  return result;
+}
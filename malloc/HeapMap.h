@@ -0,0 +1,35 @@
+#ifndef HEAP_MAP_H
+#define HEAP_MAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Internal interface between the c_malloc heap and its heap map. The heap
+// walks its chunks and blocks in address order under its lock; the map
+// turns what it sees into fragmentation numbers and page occupancy.
+
+#define MAP_PAGE 4096  // Granularity of the page map, the heap's page size
+
+// Kinds of heap spans
+#define SPAN_CHUNK 0  // A heap chunk; its blocks follow
+#define SPAN_USED 1   // An allocated block, or one in a thread cache
+#define SPAN_FREE 2   // A block on a free list
+
+// Define a structure for one chunk or block seen by a heap walk
+typedef struct {
+  int kind;            // SPAN_*
+  int size_class;      // Free list the block belongs to by its size
+  uintptr_t start;     // First byte, header included
+  size_t size;
+  uintptr_t released;  // Inner pages of a free block given to the OS
+  size_t released_size;
+} HeapSpan;
+
+// Function to visit every chunk and block of the central heap, holding
+// HEAP_LOCK throughout; 'visit' must not allocate
+void heap_walk(void (*visit)(const HeapSpan* span, void* arg), void* arg);
+
+// Function to find the smallest block size of a size class
+size_t heap_class_size(int size_class);
+
+#endif  // HEAP_MAP_H
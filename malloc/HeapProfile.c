@@ -0,0 +1,593 @@
+#define _GNU_SOURCE
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <execinfo.h>
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "HeapProfile.h"
+#include "MallocImplementation.h"
+
+// Sampling heap profiler for the c_malloc heap. Each thread counts down the
+// bytes it allocates; when the count runs out, the allocation is sampled
+// and the next count is drawn from an exponential distribution around the
+// sampling interval, so every allocated byte is equally likely to trigger a
+// sample, whatever the size mix. A sampled allocation's stack goes into a
+// side table until it is freed, so the table describes the live heap.
+//
+// Like the trace recorder, the profiler never allocates: its tables live in
+// mmap'd memory and profiles go out through write(). backtrace() may
+// allocate on its first call; allocations made while a thread is inside the
+// profiler are not sampled.
+
+#define MAX_DEPTH 32             // Frames kept per stack
+#define STACK_SLOTS 4096         // Distinct stacks, a power of two
+#define SAMPLES_INITIAL 4096     // Initial slots of the sample table
+
+// Define a structure for a distinct allocation stack and the sampled
+// allocations made from it
+typedef struct Stack {
+  uint64_t hash;                // 0 marks an empty slot
+  uint32_t depth;
+  void* frames[MAX_DEPTH];      // Innermost frame first
+  uint64_t live_objects;        // Sampled allocations not yet freed
+  uint64_t live_bytes;          // Their requested bytes
+  double live_estimate;         // Live bytes they stand for
+  uint64_t total_objects;       // Sampled allocations ever made
+  uint64_t total_bytes;
+} Stack;
+
+// Define a structure for a live sampled allocation in the sample table,
+// open addressing with linear probing
+typedef struct Sample {
+  uintptr_t ptr;   // 0 marks an empty slot
+  size_t size;     // Requested size
+  uint32_t stack;  // Index into STACKS
+} Sample;
+
+// Bounds of the PROFILE_ENTRY section, from the linker
+extern const char __start_cmalloc_entry[] __attribute__((visibility("hidden")));
+extern const char __stop_cmalloc_entry[] __attribute__((visibility("hidden")));
+
+// Mean sampling interval in bytes; 0 while the profiler is off
+static _Atomic size_t SAMPLE_BYTES = 0;
+
+static Stack* STACKS = NULL;     // STACK_SLOTS stacks
+static size_t STACKS_USED = 0;
+static Sample* SAMPLES = NULL;   // Live sampled allocations
+static size_t SAMPLES_SIZE = 0;  // Number of slots, a power of two
+static size_t SAMPLES_USED = 0;
+static uint64_t DROPPED = 0;     // Samples lost to a full table
+
+// Protects everything above
+static pthread_mutex_t PROFILE_LOCK = PTHREAD_MUTEX_INITIALIZER;
+
+// Serializes the profile writers. They copy the stacks under PROFILE_LOCK
+// and symbolize the copy after releasing it: dladdr() takes the loader
+// lock, which a thread allocating inside dlopen() holds while it waits for
+// PROFILE_LOCK.
+static pthread_mutex_t WRITE_LOCK = PTHREAD_MUTEX_INITIALIZER;
+static Stack* SNAPSHOT = NULL;  // STACK_SLOTS stacks, mapped on first use
+
+// Dumps asked for by a signal, written by the next sampled thread
+static _Atomic int DUMP_REQUESTED = 0;
+static char DUMP_PATH[4096];
+static int DUMP_FORMAT = C_MALLOC_PROFILE_PPROF;
+static unsigned DUMP_COUNT = 0;
+
+// Set while a thread is inside the profiler
+static _Thread_local int BUSY __attribute__((tls_model("initial-exec"))) = 0;
+
+// Function to write out buffered output
+void output_flush(Output* out) {
+  const char* data = out->data;
+  size_t left = out->used;
+
+  while (left > 0 && !out->failed) {
+    ssize_t n = write(out->fd, data, left);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      out->failed = 1;
+      break;
+    }
+    data += n;
+    left -= (size_t)n;
+  }
+  out->used = 0;
+}
+
+// Function to append formatted text to buffered output
+void output_printf(Output* out, const char* format, ...) {
+  if (OUTPUT_BUFFER - out->used < 512) {
+    output_flush(out);
+  }
+
+  va_list args;
+  va_start(args, format);
+  int n = vsnprintf(out->data + out->used, OUTPUT_BUFFER - out->used, format,
+                    args);
+  va_end(args);
+
+  if (n > 0) {
+    size_t room = OUTPUT_BUFFER - out->used - 1;
+    out->used += (size_t)n < room ? (size_t)n : room;
+  }
+}
+
+// Function to draw the number of bytes until a thread's next sample, from a
+// geometric distribution around the sampling interval
+int64_t profile_interval(uint64_t* rng) {
+  // xorshift64*, then a uniform double in (0, 1]
+  uint64_t x = *rng;
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  *rng = x;
+  double u = (double)(((x * 0x2545F4914F6CDD1Dull) >> 11) + 1) * 0x1p-53;
+
+  size_t mean = atomic_load_explicit(&SAMPLE_BYTES, memory_order_relaxed);
+  return (int64_t)(-log(u) * (double)mean) + 1;
+}
+
+// Function to estimate how many bytes a sampled allocation stands for. An
+// allocation of 'size' bytes is sampled with probability
+// 1 - exp(-size / mean), so dividing by that makes the estimate unbiased.
+static double sample_weight(size_t size, size_t mean) {
+  return (double)size / -expm1(-(double)size / (double)mean);
+}
+
+// Function to hash a stack; never 0, which marks empty slots
+static uint64_t stack_hash(void* const* frames, int depth) {
+  uint64_t h = 0xCBF29CE484222325ull;
+  for (int i = 0; i < depth; ++i) {
+    h = (h ^ (uintptr_t)frames[i]) * 0x100000001B3ull;
+  }
+  return h != 0 ? h : 1;
+}
+
+// Function to find or add the slot of a stack. Returns -1 when the table is
+// full. The caller must hold PROFILE_LOCK.
+static int stack_find(void* const* frames, int depth) {
+  uint64_t h = stack_hash(frames, depth);
+  size_t mask = STACK_SLOTS - 1;
+
+  for (size_t i = h & mask;; i = (i + 1) & mask) {
+    Stack* s = &STACKS[i];
+    if (s->hash == 0) {
+      if (2 * (STACKS_USED + 1) > STACK_SLOTS) {
+        return -1;
+      }
+      s->hash = h;
+      s->depth = (uint32_t)depth;
+      memcpy(s->frames, frames, depth * sizeof(void*));
+      ++STACKS_USED;
+      return (int)i;
+    }
+    if (s->hash == h && s->depth == (uint32_t)depth &&
+        memcmp(s->frames, frames, depth * sizeof(void*)) == 0) {
+      return (int)i;
+    }
+  }
+}
+
+// Function to spread pointers over the sample table; allocations are
+// 16-byte aligned, so the low bits carry no information
+static inline size_t slot_of(uintptr_t ptr) {
+  return (size_t)(((ptr >> 4) * 0x9E3779B97F4A7C15ull) >> 32) &
+         (SAMPLES_SIZE - 1);
+}
+
+// Function to map zeroed memory for a table
+static void* table_map(size_t bytes) {
+  void* p = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  return p != MAP_FAILED ? p : NULL;
+}
+
+// Function to add a sample, doubling the table at half load. Returns 0 when
+// the table could not grow. The caller must hold PROFILE_LOCK.
+static int sample_insert(uintptr_t ptr, size_t size, uint32_t stack) {
+  if (2 * (SAMPLES_USED + 1) > SAMPLES_SIZE) {
+    Sample* old = SAMPLES;
+    size_t old_size = SAMPLES_SIZE;
+    Sample* grown = table_map(2 * old_size * sizeof(Sample));
+    if (grown == NULL) {
+      return 0;
+    }
+
+    SAMPLES = grown;
+    SAMPLES_SIZE = 2 * old_size;
+    for (size_t i = 0; i < old_size; ++i) {
+      if (old[i].ptr != 0) {
+        size_t j = slot_of(old[i].ptr);
+        while (SAMPLES[j].ptr != 0) {
+          j = (j + 1) & (SAMPLES_SIZE - 1);
+        }
+        SAMPLES[j] = old[i];
+      }
+    }
+    munmap(old, old_size * sizeof(Sample));
+  }
+
+  size_t i = slot_of(ptr);
+  while (SAMPLES[i].ptr != 0) {
+    i = (i + 1) & (SAMPLES_SIZE - 1);
+  }
+  SAMPLES[i].ptr = ptr;
+  SAMPLES[i].size = size;
+  SAMPLES[i].stack = stack;
+  ++SAMPLES_USED;
+  return 1;
+}
+
+// Function to take a sample out of the table into 'sample'. Later entries of
+// the probe run are shifted back into the gap, so lookups never need
+// tombstones. Returns 0 for pointers that are not in the table. The caller
+// must hold PROFILE_LOCK.
+static int sample_remove(uintptr_t ptr, Sample* sample) {
+  size_t mask = SAMPLES_SIZE - 1;
+  size_t i = slot_of(ptr);
+
+  while (SAMPLES[i].ptr != ptr) {
+    if (SAMPLES[i].ptr == 0) {
+      return 0;
+    }
+    i = (i + 1) & mask;
+  }
+  *sample = SAMPLES[i];
+
+  for (size_t j = (i + 1) & mask; SAMPLES[j].ptr != 0; j = (j + 1) & mask) {
+    size_t home = slot_of(SAMPLES[j].ptr);
+    if (((j - home) & mask) >= ((j - i) & mask)) {
+      SAMPLES[i] = SAMPLES[j];
+      i = j;
+    }
+  }
+  SAMPLES[i].ptr = 0;
+  --SAMPLES_USED;
+  return 1;
+}
+
+// Function to check whether a return address lies in a PROFILE_ENTRY
+// function. A call may be the last instruction of its function, so the
+// address is moved back into the call first.
+static int in_entry(void* frame) {
+  const char* pc = (const char*)frame - 1;
+  return pc >= __start_cmalloc_entry && pc < __stop_cmalloc_entry;
+}
+
+// Function to record a sampled allocation with the stack of its caller,
+// leaving out the frames of the allocator entry points
+__attribute__((noinline)) PROFILE_ENTRY int profile_add(void* ptr,
+                                                       size_t size) {
+  if (BUSY) {
+    return 0;
+  }
+  BUSY = 1;
+
+  // Frame 0 is this function, or a sanitizer's backtrace() interceptor with
+  // this function next; both belong to the allocator
+  void* frames[MAX_DEPTH + 8];
+  int depth = backtrace(frames, MAX_DEPTH + 8);
+  int first = 1;
+  while (first < depth && in_entry(frames[first])) {
+    ++first;
+  }
+  depth -= first;
+  if (depth > MAX_DEPTH) {
+    depth = MAX_DEPTH;
+  }
+
+  int recorded = 0;
+  pthread_mutex_lock(&PROFILE_LOCK);
+  size_t mean = atomic_load_explicit(&SAMPLE_BYTES, memory_order_relaxed);
+  if (mean != 0) {
+    int slot = stack_find(frames + first, depth);
+    if (slot >= 0 && sample_insert((uintptr_t)ptr, size, (uint32_t)slot)) {
+      Stack* s = &STACKS[slot];
+      ++s->live_objects;
+      s->live_bytes += size;
+      s->live_estimate += sample_weight(size, mean);
+      ++s->total_objects;
+      s->total_bytes += size;
+      recorded = 1;
+    } else {
+      ++DROPPED;
+    }
+  }
+  pthread_mutex_unlock(&PROFILE_LOCK);
+
+  BUSY = 0;
+  return recorded;
+}
+
+// Function to drop a sampled allocation before its block is released
+void profile_remove(void* ptr) {
+  pthread_mutex_lock(&PROFILE_LOCK);
+  size_t mean = atomic_load_explicit(&SAMPLE_BYTES, memory_order_relaxed);
+  Sample sample;
+  if (SAMPLES != NULL && sample_remove((uintptr_t)ptr, &sample)) {
+    Stack* s = &STACKS[sample.stack];
+    --s->live_objects;
+    s->live_bytes -= sample.size;
+    s->live_estimate -= sample_weight(sample.size, mean);
+    if (s->live_objects == 0) {
+      s->live_estimate = 0;  // No rounding residue on empty stacks
+    }
+  }
+  pthread_mutex_unlock(&PROFILE_LOCK);
+}
+
+// Fork handlers keep the profiler's locks consistent in the child, as
+// MallocImplementation.c does for the heap lock. A writer holds WRITE_LOCK
+// while it takes PROFILE_LOCK, so they are taken in that order.
+static void fork_prepare() {
+  pthread_mutex_lock(&WRITE_LOCK);
+  pthread_mutex_lock(&PROFILE_LOCK);
+}
+static void fork_parent() {
+  pthread_mutex_unlock(&PROFILE_LOCK);
+  pthread_mutex_unlock(&WRITE_LOCK);
+}
+static void fork_child() { fork_parent(); }
+
+// pthread_atfork() may allocate, so it runs from a constructor
+__attribute__((constructor)) static void register_fork_handlers() {
+  pthread_atfork(fork_prepare, fork_parent, fork_child);
+}
+
+// Function to copy /proc/self/maps into profile output, which pprof needs to
+// symbolize addresses
+static void write_mappings(Output* out) {
+  int fd = open("/proc/self/maps", O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return;
+  }
+
+  output_flush(out);
+  ssize_t n;
+  while ((n = read(fd, out->data, OUTPUT_BUFFER)) > 0) {
+    out->used = (size_t)n;
+    output_flush(out);
+  }
+  close(fd);
+}
+
+// Function to print a frame for a collapsed stack: its symbol, else its
+// module and offset, else its address
+static void write_frame(Output* out, void* frame) {
+  Dl_info info;
+  if (dladdr(frame, &info) == 0) {
+    output_printf(out, "0x%lx", (unsigned long)(uintptr_t)frame);
+  } else if (info.dli_sname != NULL) {
+    output_printf(out, "%s", info.dli_sname);
+  } else {
+    const char* name = strrchr(info.dli_fname, '/');
+    output_printf(out, "%s+0x%lx", name != NULL ? name + 1 : info.dli_fname,
+                  (unsigned long)((uintptr_t)frame -
+                                  (uintptr_t)info.dli_fbase));
+  }
+}
+
+// Function to write the profile of the sampled live heap from a copy of
+// its 'count' stacks, sampled every 'mean' bytes
+static void write_profile(Output* out, int format, const Stack* stacks,
+                          size_t count, size_t mean) {
+  if (format == C_MALLOC_PROFILE_COLLAPSED) {
+    // One line per stack with live memory, outermost frame first, with the
+    // estimated live bytes
+    for (size_t i = 0; i < count; ++i) {
+      const Stack* s = &stacks[i];
+      if (s->live_objects == 0) {
+        continue;
+      }
+      for (uint32_t f = s->depth; f-- > 0;) {
+        write_frame(out, s->frames[f]);
+        output_printf(out, f != 0 ? ";" : "");
+      }
+      output_printf(out, " %.0f\n", s->live_estimate);
+    }
+    output_flush(out);
+    return;
+  }
+
+  // Legacy heap profile that pprof reads and scales itself: sampled counts
+  // and bytes, live first and all-time in brackets
+  uint64_t live_objects = 0, live_bytes = 0;
+  uint64_t total_objects = 0, total_bytes = 0;
+  for (size_t i = 0; i < count; ++i) {
+    live_objects += stacks[i].live_objects;
+    live_bytes += stacks[i].live_bytes;
+    total_objects += stacks[i].total_objects;
+    total_bytes += stacks[i].total_bytes;
+  }
+
+  output_printf(out,
+                "heap profile: %llu: %llu [%llu: %llu] @ heap_v2/%zu\n",
+                (unsigned long long)live_objects,
+                (unsigned long long)live_bytes,
+                (unsigned long long)total_objects,
+                (unsigned long long)total_bytes, mean);
+  for (size_t i = 0; i < count; ++i) {
+    const Stack* s = &stacks[i];
+    output_printf(out, "%llu: %llu [%llu: %llu] @",
+                  (unsigned long long)s->live_objects,
+                  (unsigned long long)s->live_bytes,
+                  (unsigned long long)s->total_objects,
+                  (unsigned long long)s->total_bytes);
+    for (uint32_t f = 0; f < s->depth; ++f) {
+      output_printf(out, " %p", s->frames[f]);
+    }
+    output_printf(out, "\n");
+  }
+  output_printf(out, "\nMAPPED_LIBRARIES:\n");
+  write_mappings(out);
+}
+
+// Function to write the profile of the sampled live heap to a file
+// descriptor. The caller must hold WRITE_LOCK. Returns 0 on success.
+static int write_locked(int fd, int format) {
+  static Output out;  // Too large for small thread stacks; under WRITE_LOCK
+
+  int busy = BUSY;
+  BUSY = 1;  // dladdr() may allocate; keep that out of the profile
+
+  size_t count = 0;
+  size_t mean = 0;
+  int copied = 0;
+  pthread_mutex_lock(&PROFILE_LOCK);
+  if (STACKS != NULL && SNAPSHOT == NULL) {
+    SNAPSHOT = table_map(STACK_SLOTS * sizeof(Stack));
+  }
+  if (STACKS != NULL && SNAPSHOT != NULL) {
+    for (size_t i = 0; i < STACK_SLOTS; ++i) {
+      if (STACKS[i].hash != 0) {
+        SNAPSHOT[count++] = STACKS[i];
+      }
+    }
+    mean = atomic_load_explicit(&SAMPLE_BYTES, memory_order_relaxed);
+    copied = 1;
+  }
+  pthread_mutex_unlock(&PROFILE_LOCK);
+
+  int result = -1;
+  if (copied) {
+    out.fd = fd;
+    out.used = 0;
+    out.failed = 0;
+    write_profile(&out, format, SNAPSHOT, count, mean);
+    output_flush(&out);
+    result = out.failed ? -1 : 0;
+  }
+
+  BUSY = busy;
+  return result;
+}
+
+// Function to write the profile of the sampled live heap to a file
+// descriptor. Returns 0 on success.
+int c_malloc_profile_write(int fd, int format) {
+  pthread_mutex_lock(&WRITE_LOCK);
+  int result = write_locked(fd, format);
+  pthread_mutex_unlock(&WRITE_LOCK);
+  return result;
+}
+
+// Function to write the profile of the sampled live heap to a file
+int c_malloc_profile_dump(const char* path, int format) {
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    return -1;
+  }
+  int result = c_malloc_profile_write(fd, format);
+  close(fd);
+  return result;
+}
+
+// Function to sample about one allocation per 'sample_bytes' bytes, or to
+// stop and drop all samples when it is 0
+int c_malloc_profile_start(size_t sample_bytes) {
+  // backtrace() allocates when it first runs; get that over with here
+  void* frames[1];
+  int busy = BUSY;
+  BUSY = 1;
+  backtrace(frames, 1);
+  BUSY = busy;
+
+  pthread_mutex_lock(&PROFILE_LOCK);
+  if (STACKS != NULL) {
+    munmap(STACKS, STACK_SLOTS * sizeof(Stack));
+    munmap(SAMPLES, SAMPLES_SIZE * sizeof(Sample));
+    STACKS = NULL;
+    SAMPLES = NULL;
+  }
+  STACKS_USED = SAMPLES_USED = 0;
+  DROPPED = 0;
+
+  int result = 0;
+  if (sample_bytes != 0) {
+    STACKS = table_map(STACK_SLOTS * sizeof(Stack));
+    SAMPLES = table_map(SAMPLES_INITIAL * sizeof(Sample));
+    SAMPLES_SIZE = SAMPLES_INITIAL;
+    if (STACKS == NULL || SAMPLES == NULL) {
+      if (STACKS != NULL) {
+        munmap(STACKS, STACK_SLOTS * sizeof(Stack));
+      }
+      if (SAMPLES != NULL) {
+        munmap(SAMPLES, SAMPLES_INITIAL * sizeof(Sample));
+      }
+      STACKS = NULL;
+      SAMPLES = NULL;
+      sample_bytes = 0;
+      result = -1;
+    }
+  }
+  atomic_store_explicit(&SAMPLE_BYTES, sample_bytes, memory_order_relaxed);
+  pthread_mutex_unlock(&PROFILE_LOCK);
+
+  heap_set_hook(HOOK_PROFILE, sample_bytes != 0);
+  return result;
+}
+
+// Function to write the profile a signal asked for, if any
+void profile_poll(void) {
+  if (__builtin_expect(
+          !atomic_load_explicit(&DUMP_REQUESTED, memory_order_relaxed), 1) ||
+      !atomic_exchange_explicit(&DUMP_REQUESTED, 0, memory_order_relaxed)) {
+    return;
+  }
+
+  // Another thread is writing a profile; a later allocation tries again
+  // rather than waiting, since this one may be inside dlopen()
+  if (pthread_mutex_trylock(&WRITE_LOCK) != 0) {
+    atomic_store_explicit(&DUMP_REQUESTED, 1, memory_order_relaxed);
+    return;
+  }
+
+  char path[sizeof(DUMP_PATH) + 32];
+  snprintf(path, sizeof(path), "%s.%u.%s", DUMP_PATH, ++DUMP_COUNT,
+           DUMP_FORMAT == C_MALLOC_PROFILE_COLLAPSED ? "folded" : "heap");
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd >= 0) {
+    write_locked(fd, DUMP_FORMAT);
+    close(fd);
+  }
+  pthread_mutex_unlock(&WRITE_LOCK);
+}
+
+// Function run on the dump signal; it can interrupt the profiler itself, so
+// it only raises a flag
+static void on_dump_signal(int signo) {
+  (void)signo;
+  atomic_store_explicit(&DUMP_REQUESTED, 1, memory_order_relaxed);
+}
+
+// Function to write a profile to '<path>.<n>.heap', or '.folded' for the
+// collapsed format, each time 'signo' arrives
+int c_malloc_profile_on_signal(int signo, const char* path, int format) {
+  size_t length = strnlen(path, sizeof(DUMP_PATH));
+  if (length == sizeof(DUMP_PATH)) {
+    return -1;
+  }
+  memcpy(DUMP_PATH, path, length + 1);
+  DUMP_FORMAT = format;
+
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = on_dump_signal;
+  action.sa_flags = SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  return sigaction(signo, &action, NULL);
+}
@@ -0,0 +1,65 @@
+#ifndef HEAP_PROFILE_H
+#define HEAP_PROFILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Internal interface between the c_malloc heap and its sampling heap
+// profiler. The heap counts down each thread's bytes to the next sample and
+// marks sampled blocks in their header; the profiler keeps the stacks of the
+// marked blocks in a side table until they are freed.
+
+// Bits of the heap's hook word; c_malloc and c_free take their slow path
+// while any of them is set
+#define HOOK_LATENCY 0x1  // Latency histograms are sampled
+#define HOOK_PROFILE 0x2  // Allocations are sampled for the heap profile
+
+// Function to switch one of the heap's hooks on or off
+void heap_set_hook(unsigned hook, int on);
+
+// Function to draw the number of bytes until a thread's next sample, from a
+// geometric distribution around the sampling interval
+int64_t profile_interval(uint64_t* rng);
+
+// Marks the functions that allocate on behalf of their caller: the c_malloc
+// entry points and the LD_PRELOAD wrappers around them. They share one text
+// section, and profile stacks start at the first frame outside it, however
+// the compiler inlined or tail-called its way through them.
+#define PROFILE_ENTRY __attribute__((section("cmalloc_entry")))
+
+// Function to record a sampled allocation with the stack of its caller,
+// leaving out the frames of the PROFILE_ENTRY functions it came through.
+// Returns 0 when the sample was not recorded, as when the profiler stopped
+// meanwhile.
+int profile_add(void* ptr, size_t size);
+
+// Function to drop a sampled allocation; must run before the block goes
+// back to the heap, where another thread could be handed its address
+void profile_remove(void* ptr);
+
+// Function to write the profile a signal asked for, if any
+void profile_poll(void);
+
+// Buffered output to a file descriptor for the profiler and the heap map.
+// Neither may allocate while they write, so text is formatted into a fixed
+// buffer and goes out through write().
+#define OUTPUT_BUFFER 8192  // Bytes collected before a write()
+
+// Define a structure for buffered output to a file descriptor
+typedef struct {
+  int fd;
+  size_t used;
+  int failed;  // Set once a write() failed; later output is dropped
+  char data[OUTPUT_BUFFER];
+} Output;
+
+// Function to write out buffered output
+void output_flush(Output* out);
+
+// Function to append formatted text to buffered output; text past the first
+// 511 bytes of a single call may be cut off
+__attribute__((format(printf, 2, 3))) void output_printf(Output* out,
+                                                         const char* format,
+                                                         ...);
+
+#endif  // HEAP_PROFILE_H
@@ -1,177 +1,1325 @@
+#define _GNU_SOURCE
+
 #include <assert.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
 
-#define STACK_SIZE 32
-#define HEAP_SIZE (STACK_SIZE * 4)
-#define HEADER 4
+#include "HeapMap.h"
+#include "HeapProfile.h"
+#include "MallocImplementation.h"
 
-static uint16_t IN_USE = 0;
+#define PAGE_SIZE 4096
+#define CHUNK_SIZE (1 << 20)           // Smallest heap extension from the OS
+#define MAX_CHUNK_SIZE (64 << 20)      // Largest heap extension from the OS
+#define MMAP_THRESHOLD (128 * 1024)    // Requests from here get own mapping
+#define HEADER 8     // Size header, pointer-sized so free blocks can hold links
+#define ALIGNMENT 16  // Alignment of user pointers and granularity of sizes
 
-// Define a structure for managing virtual memory
-typedef struct {
-  uint8_t stack[STACK_SIZE];  // Stack memory area
-  char** unmapped;            // Placeholder for unmapped memory
-  uint8_t heap[HEAP_SIZE];    // Heap memory area
-
-  struct {
-    char** data;  // Placeholder for data section
-    char** bss;   // Placeholder for bss section
-    char** text;  // Placeholder for text section
-  } data_t;
-} VirtualMemory;
-
-// Define a structure for memory entities
-typedef struct {
-  uint8_t* ptr;   // Pointer to the allocated memory block
-  uint16_t size;  // Size of the allocated memory block
-} Entity;
+// Smallest block that can hold the header, the free-list links and a footer
+#define MIN_BLOCK (HEADER + 2 * sizeof(void*) + sizeof(size_t))
+
+// Size classes: blocks below SMALL_LIMIT get an exact bin per ALIGNMENT step,
+// larger ones are split into power-of-two ranges with 2^SUB_BITS
+// intermediate classes each. One bit per bin in BIN_MAP marks non-empty bins.
+#define SMALL_SHIFT 6
+#define SMALL_LIMIT (1 << SMALL_SHIFT)
+#define SMALL_BINS ((SMALL_LIMIT - MIN_BLOCK) / ALIGNMENT)
+#define SUB_BITS 2
+#define BIN_COUNT 64
+
+// Size header flags. Sizes are multiples of ALIGNMENT, so the low bits are
+// free to record the block state (boundary tags).
+#define INUSE 0x1       // The block is allocated
+#define PREV_INUSE 0x2  // The physically previous block is allocated
+#define MAPPED 0x4      // The block lives in its own mapping
+#define DECOMMITTED 0x8 // Free block whose inner pages were given to the OS
+#define SAMPLED 0x8     // Allocated block recorded by the heap profiler
+#define FLAGS (INUSE | PREV_INUSE | MAPPED | DECOMMITTED)
+
+// Advice used to give free pages back. MADV_DONTNEED drops them from the
+// resident set at once; MADV_FREE is cheaper, but the kernel only takes the
+// pages when it runs short of memory, so RSS does not drop right away.
+#ifndef DECOMMIT_ADVICE
+#define DECOMMIT_ADVICE MADV_DONTNEED
+#endif
+
+static size_t IN_USE = 0;        // Number of blocks on the free lists
+static size_t HEAP_MAPPED = 0;   // Bytes mapped for heap chunks
+static size_t CHUNK_COUNT = 0;   // Number of heap chunks
+
+// Decommit bookkeeping, under HEAP_LOCK. DECOMMITTED_BYTES sums the pages of
+// free blocks flagged DECOMMITTED; a flagged block that merges with a
+// neighbor loses its flag, so the heap may hold fewer resident pages than
+// HEAP_MAPPED - DECOMMITTED_BYTES until the next trim or decay pass.
+static size_t DECOMMITTED_BYTES = 0;  // Free pages currently decommitted
+static size_t DECOMMITTED_TOTAL = 0;  // Bytes decommitted so far
+static uint64_t DECOMMITS = 0;        // madvise() calls so far
+static uint64_t LAST_DECAY = 0;       // Time of the last decay pass
+static int DECAY_THREAD = 0;          // 1 while the decay thread runs
+
+// Free heap memory idle for this long is decommitted; 0 disables decay
+static _Atomic uint64_t DECAY_NS = 0;
+
+// Statistics. Counters with a single writer at a time (the lock holder or
+// the owning thread) are updated with relaxed load/store pairs, which cost the
+// same as plain increments but can be read by c_malloc_stats() at any time.
+#define STAT_ADD(counter, n)                                                  \
+  atomic_store_explicit(                                                      \
+      &(counter),                                                             \
+      atomic_load_explicit(&(counter), memory_order_relaxed) + (n),           \
+      memory_order_relaxed)
+
+static _Atomic size_t HEAP_IN_USE = 0;    // Bytes handed out by the heap
+static _Atomic size_t LARGE_MAPPED = 0;   // Bytes in dedicated mappings
+static _Atomic size_t PEAK_IN_USE = 0;    // High-water mark of both above
+static _Atomic uint64_t COALESCES = 0;    // Merges done by heap_free()
+
+// HOOK_* bits of the instrumentation that is switched on. With all of them
+// clear, c_malloc() and c_free() pay a single predictable branch for it.
+static _Atomic unsigned HOOKS = 0;
+
+// Sampled latency histograms; bucket i counts operations of [2^i, 2^(i+1)) ns
+static _Atomic unsigned SAMPLE_EVERY = 0;  // 0 disables sampling
+static _Atomic uint64_t MALLOC_LATENCY[C_MALLOC_LATENCY_BUCKETS];
+static _Atomic uint64_t FREE_LATENCY[C_MALLOC_LATENCY_BUCKETS];
+
+// Protects the bins and the heap; thread caches below are lock-free
+static pthread_mutex_t HEAP_LOCK = PTHREAD_MUTEX_INITIALIZER;
+
+// Define a structure for memory blocks. The size header is always present;
+// the links are only valid while the block sits on a free list and overlap
+// the user data otherwise. Free blocks also repeat their size in a footer in
+// their last word, so the block after them can find their start; allocated
+// blocks skip the footer and announce themselves through PREV_INUSE instead.
+typedef struct Block {
+  size_t size;         // Size of the block including the header, plus flags
+  struct Block* next;  // Next free block in the same bin
+  struct Block* prev;  // Previous free block in the same bin
+} Block;
+
+// Define a structure for the start of every heap chunk. The blocks follow it
+// and end in an epilogue: a zero-sized header marked in use, so coalescing
+// never runs past the chunk.
+typedef struct Chunk {
+  struct Chunk* next;  // Next chunk in CHUNKS
+  size_t size;         // Size of the mapping
+} Chunk;
+
+// Block headers sit HEADER bytes below an ALIGNMENT boundary, so every user
+// pointer is aligned as long as block sizes are multiples of ALIGNMENT. The
+// first block of a chunk starts CHUNK_HEADER bytes in; the first header of a
+// dedicated mapping starts MAPPED_HEADER bytes in.
+#define CHUNK_HEADER \
+  (((sizeof(Chunk) + HEADER + ALIGNMENT - 1) & ~(size_t)(ALIGNMENT - 1)) - \
+   HEADER)
+#define MAPPED_HEADER (ALIGNMENT - HEADER)
+
+static Block* BINS[BIN_COUNT];  // Segregated free lists, one per size class
+static uint64_t BIN_MAP = 0;    // Bit i is set when BINS[i] is non-empty
+static Chunk* CHUNKS = NULL;    // All heap chunks
+
+// Function to read a block header. The owner of an allocated block reads it
+// without the lock while a neighbor's heap operation may flip its
+// PREV_INUSE bit, so headers go through relaxed atomics.
+static inline size_t header(const Block* b) {
+  return __atomic_load_n(&b->size, __ATOMIC_RELAXED);
+}
+
+// Function to read the size of a block without its flags
+static inline size_t size_of(const Block* b) {
+  return header(b) & ~(size_t)FLAGS;
+}
+
+// Function to find the physically next block
+static inline Block* next_block(Block* b) {
+  return (Block*)((uint8_t*)b + size_of(b));
+}
+
+// Function to find the physically previous block; only valid when it is free
+static inline Block* prev_block(Block* b) {
+  return (Block*)((uint8_t*)b - ((size_t*)b)[-1]);
+}
+
+// Function to record in the next block whether 'b' is in use. The owner of
+// the next block may be marking it SAMPLED at the same time, so both sides
+// update the header with atomic read-modify-writes.
+static inline void set_next_prev_inuse(Block* b, int inuse) {
+  Block* next = next_block(b);
+  if (inuse) {
+    __atomic_fetch_or(&next->size, PREV_INUSE, __ATOMIC_RELAXED);
+  } else {
+    __atomic_fetch_and(&next->size, ~(size_t)PREV_INUSE, __ATOMIC_RELAXED);
+  }
+}
+
+// Function to find the first block of a heap chunk
+static inline Block* chunk_first(Chunk* c) {
+  return (Block*)((uint8_t*)c + CHUNK_HEADER);
+}
 
-Entity LIST[40];  // List of memory entities (free-list)
+// Function to find the start of the mapping that holds a MAPPED block. The
+// header always lies in the first page of its mapping.
+static inline uint8_t* mapping_of(Block* b) {
+  return (uint8_t*)((uintptr_t)b & ~(uintptr_t)(PAGE_SIZE - 1));
+}
+
+// Function to read the length of the mapping that holds a MAPPED block. The
+// block may still carry SAMPLED from a profiler that has stopped since.
+static inline size_t mapped_size(const Block* b) {
+  return header(b) & ~(size_t)(MAPPED | SAMPLED);
+}
 
-// Function to log the current state of memory entities
+// Function to copy the size of a free block into its footer
+static inline void set_footer(Block* b) {
+  ((size_t*)next_block(b))[-1] = size_of(b);
+}
+
+// Free blocks of at least a page record when they were freed in the word
+// after their links; decay compares it against the clock
+#define STAMPED_BLOCK PAGE_SIZE
+
+// Function to find the free-time stamp of a free block of STAMPED_BLOCK
+// bytes or more
+static inline uint64_t* free_stamp(Block* b) {
+  return (uint64_t*)(b + 1);
+}
+
+// Function to find the whole pages of a free block that hold neither its
+// header, links and stamp nor its footer; those can be given to the OS
+static size_t decommit_span(Block* b, uint8_t** start) {
+  uintptr_t first = ((uintptr_t)(free_stamp(b) + 1) + PAGE_SIZE - 1) &
+                    ~(uintptr_t)(PAGE_SIZE - 1);
+  uintptr_t last = ((uintptr_t)next_block(b) - sizeof(size_t)) &
+                   ~(uintptr_t)(PAGE_SIZE - 1);
+  *start = (uint8_t*)first;
+  return last > first ? last - first : 0;
+}
+
+// Function to map a block size to its size class
+static int bin_index(size_t size) {
+  if (size < SMALL_LIMIT) {
+    return (int)((size - MIN_BLOCK) / ALIGNMENT);
+  }
+
+  int shift = 63 - __builtin_clzll(size);
+  int sub = (int)(size >> (shift - SUB_BITS)) & ((1 << SUB_BITS) - 1);
+  int index = SMALL_BINS + ((shift - SMALL_SHIFT) << SUB_BITS) + sub;
+
+  return index < BIN_COUNT ? index : BIN_COUNT - 1;
+}
+
+// Function to find the first bin whose blocks are all at least 'size' bytes
+static int fit_index(size_t size) {
+  if (size >= SMALL_LIMIT) {
+    int shift = 63 - __builtin_clzll(size);
+    size += ((size_t)1 << (shift - SUB_BITS)) - 1;  // Round up to next class
+  }
+  return bin_index(size);
+}
+
+// Function to push a block on the free list of its size class
+static void bin_insert(Block* b) {
+  int i = bin_index(size_of(b));
+
+  b->prev = NULL;
+  b->next = BINS[i];
+  if (BINS[i] != NULL) {
+    BINS[i]->prev = b;
+  }
+  BINS[i] = b;
+  BIN_MAP |= (uint64_t)1 << i;
+  ++IN_USE;
+}
+
+// Function to give the inner pages of a free block to the OS. The caller
+// must hold HEAP_LOCK.
+static size_t decommit(Block* b) {
+  uint8_t* start;
+  size_t span = decommit_span(b, &start);
+
+  if ((b->size & DECOMMITTED) || span == 0 ||
+      madvise(start, span, DECOMMIT_ADVICE) != 0) {
+    return 0;
+  }
+  b->size |= DECOMMITTED;
+  DECOMMITTED_BYTES += span;
+  DECOMMITTED_TOTAL += span;
+  ++DECOMMITS;
+  return span;
+}
+
+// Function to unlink a block from the free list of its size class
+static void bin_remove(Block* b) {
+  int i = bin_index(size_of(b));
+
+  // Its pages come back on first touch; the block is about to change
+  if (b->size & DECOMMITTED) {
+    uint8_t* start;
+    DECOMMITTED_BYTES -= decommit_span(b, &start);
+  }
+
+  if (b->prev != NULL) {
+    b->prev->next = b->next;
+  } else {
+    BINS[i] = b->next;
+  }
+  if (b->next != NULL) {
+    b->next->prev = b->prev;
+  }
+  if (BINS[i] == NULL) {
+    BIN_MAP &= ~((uint64_t)1 << i);
+  }
+  --IN_USE;
+}
+
+// Function to search one bin for the first block of at least 'size' bytes
+static Block* first_fit(int index, size_t size) {
+  for (Block* b = BINS[index]; b != NULL; b = b->next) {
+    if (size_of(b) >= size) {
+      return b;
+    }
+  }
+  return NULL;
+}
+
+#ifdef C_MALLOC_LOG
+// Function to log the current state of memory entities. It prints the whole
+// free list on every heap operation, so it is only built on request; stdio
+// allocates, so it cannot be used in the LD_PRELOAD library either.
 void LOG() {
   printf("LIST:\n");
-  for (int i = 0; i < IN_USE; ++i) {
-    printf("Data + HEADER.[%p]. Memory of our heap free:[%u]\n",
-           (void*)LIST[i].ptr, LIST[i].size);
+  for (int i = 0; i < BIN_COUNT; ++i) {
+    for (Block* b = BINS[i]; b != NULL; b = b->next) {
+      printf("Data + HEADER.[%p]. Memory of our heap free:[%zu] bin:[%d]\n",
+             (void*)b, size_of(b), i);
+    }
+  }
+  printf("Entities in use:[%zu]\n", IN_USE);
+}
+#else
+#define LOG() ((void)0)
+#endif
+
+// Function to read a monotonic clock in nanoseconds
+static uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+// Function to read the clock for a free-time stamp; 0 while decay is off, so
+// blocks freed then count as idle since the start once it is switched on
+static uint64_t free_time() {
+  return atomic_load_explicit(&DECAY_NS, memory_order_relaxed) != 0 ? now_ns()
+                                                                     : 0;
+}
+
+// Function to raise the peak after the bytes in use grew
+static void update_peak() {
+  size_t now = atomic_load_explicit(&HEAP_IN_USE, memory_order_relaxed) +
+               atomic_load_explicit(&LARGE_MAPPED, memory_order_relaxed);
+  size_t peak = atomic_load_explicit(&PEAK_IN_USE, memory_order_relaxed);
+
+  while (now > peak &&
+         !atomic_compare_exchange_weak_explicit(&PEAK_IN_USE, &peak, now,
+                                                memory_order_relaxed,
+                                                memory_order_relaxed)) {
+  }
+}
+
+// Function to map a new heap chunk of at least 'size' bytes and return it as
+// one free block. Chunks grow with the heap so that large working sets need
+// few mappings.
+static Block* heap_grow(size_t size) {
+  size_t chunk = HEAP_MAPPED / 4;
+  if (chunk < CHUNK_SIZE) {
+    chunk = CHUNK_SIZE;
+  }
+  if (chunk > MAX_CHUNK_SIZE) {
+    chunk = MAX_CHUNK_SIZE;
+  }
+  if (chunk < size + CHUNK_HEADER + HEADER) {
+    chunk = size + CHUNK_HEADER + HEADER;
+  }
+  chunk = (chunk + PAGE_SIZE - 1) & ~(size_t)(PAGE_SIZE - 1);
+
+  void* p = mmap(NULL, chunk, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED) {
+    return NULL;
+  }
+
+  Chunk* c = p;
+  c->size = chunk;
+  c->next = CHUNKS;
+  CHUNKS = c;
+  HEAP_MAPPED += chunk;
+  ++CHUNK_COUNT;
+
+  // One free block spans the chunk between its header and the epilogue
+  Block* b = chunk_first(c);
+  b->size = (chunk - CHUNK_HEADER - HEADER) | PREV_INUSE;
+  set_footer(b);
+  *free_stamp(b) = free_time();
+  next_block(b)->size = INUSE;
+  return b;
+}
+
+// Function to find and unlink a free block that can hold 'size' bytes
+Block* new_entity(size_t size) {
+  // Every block in a bin above the exact one is large enough, so the lowest
+  // non-empty one is found with a single bit scan
+  uint64_t candidates = BIN_MAP & (~(uint64_t)0 << fit_index(size));
+
+  Block* best = NULL;
+  if (candidates != 0 && __builtin_ctzll(candidates) < BIN_COUNT - 1) {
+    best = BINS[__builtin_ctzll(candidates)];
+  }
+
+  // The exact bin may still hold a large enough block and the last bin is
+  // open-ended, so fall back to a first-fit search of those two
+  if (best == NULL) {
+    best = first_fit(bin_index(size), size);
+  }
+  if (best == NULL) {
+    best = first_fit(BIN_COUNT - 1, size);
+  }
+
+  // If no suitable block is found, extend the heap
+  if (best == NULL) {
+    return heap_grow(size);
+  }
+
+  bin_remove(best);
+  return best;
+}
+
+// Function to turn a request into a block size including the header
+static size_t block_size(size_t size) {
+  size = (size + HEADER + ALIGNMENT - 1) & ~(size_t)(ALIGNMENT - 1);
+  return size < MIN_BLOCK ? MIN_BLOCK : size;
+}
+
+// Function to carve a block of exactly 'size' bytes out of the central heap.
+// The caller must hold HEAP_LOCK.
+static Block* heap_malloc(size_t size) {
+  // Try to find a suitable memory block for allocation
+  Block* b = new_entity(size);
+
+  if (b == NULL) {
+    return NULL;  // Allocation failed
+  }
+
+  // Return the tail to the free lists if it can stand on its own. A tail
+  // of a decommitted block keeps its flag: its inner pages are a subset of
+  // the block's, and none of them has been touched.
+  size_t available = size_of(b);
+  if (available - size >= MIN_BLOCK) {
+    Block* rest = (Block*)((uint8_t*)b + size);
+    rest->size = (available - size) | PREV_INUSE;
+    set_footer(rest);
+    if (available - size >= STAMPED_BLOCK) {
+      *free_stamp(rest) = *free_stamp(b);
+      uint8_t* start;
+      size_t span = decommit_span(rest, &start);
+      if ((b->size & DECOMMITTED) && span != 0) {
+        rest->size |= DECOMMITTED;
+        DECOMMITTED_BYTES += span;
+      }
+    }
+    bin_insert(rest);
+    b->size = size | INUSE | (b->size & PREV_INUSE);
+  } else {
+    b->size = (b->size | INUSE) & ~(size_t)DECOMMITTED;
+    set_next_prev_inuse(b, 1);
+  }
+
+  STAT_ADD(HEAP_IN_USE, size_of(b));
+  update_peak();
+
+  LOG();  // Log the current state of memory
+
+  return b;
+}
+
+// Function to decommit every free block that has been idle for the decay
+// time. Only bins that can hold a block of STAMPED_BLOCK bytes are walked.
+// The caller must hold HEAP_LOCK.
+static void heap_decay(uint64_t now) {
+  uint64_t decay = atomic_load_explicit(&DECAY_NS, memory_order_relaxed);
+  LAST_DECAY = now;
+
+  for (int i = bin_index(STAMPED_BLOCK); i < BIN_COUNT; ++i) {
+    for (Block* b = BINS[i]; b != NULL; b = b->next) {
+      if (size_of(b) >= STAMPED_BLOCK && now - *free_stamp(b) >= decay) {
+        decommit(b);
+      }
+    }
+  }
+}
+
+// Function to return a block to the central heap, merging it with free
+// neighbors. The boundary tags locate both neighbors directly, so this takes
+// constant time. Large free blocks get their free time, and decay runs
+// from here at most twice per decay time. The caller must hold HEAP_LOCK.
+static void heap_free(Block* b) {
+  assert((header(b) & INUSE) && size_of(b) >= MIN_BLOCK);  // Header intact
+
+  size_t size = size_of(b);
+  Block* after = next_block(b);
+
+  STAT_ADD(HEAP_IN_USE, -size);
+
+  // Check if we can merge with the block before
+  if (!(header(b) & PREV_INUSE)) {
+    Block* before = prev_block(b);
+    bin_remove(before);
+    size += size_of(before);
+    b = before;
+    STAT_ADD(COALESCES, 1);
+  }
+
+  // Check if we can merge with the block after. Its owner may be marking
+  // it SAMPLED meanwhile, hence the atomic read.
+  if (!(header(after) & INUSE)) {
+    bin_remove(after);
+    size += size_of(after);
+    STAT_ADD(COALESCES, 1);
+  }
+
+  // The block before a free block is always in use, as they would have merged
+  b->size = size | PREV_INUSE;
+  set_footer(b);
+  set_next_prev_inuse(b, 0);
+  bin_insert(b);
+
+  if (size >= STAMPED_BLOCK) {
+    uint64_t now = free_time();
+    *free_stamp(b) = now;
+    uint64_t decay = atomic_load_explicit(&DECAY_NS, memory_order_relaxed);
+    if (decay != 0 && now - LAST_DECAY >= decay / 2) {
+      heap_decay(now);
+    }
+  }
+
+  LOG();  // Log the current state of memory
+}
+
+// Function to cut an allocated block down to 'size' bytes, handing the tail
+// back to the heap where it merges with a free successor. Tails too small to
+// stand on their own stay with the block. The caller must hold HEAP_LOCK.
+static void heap_trim(Block* b, size_t size) {
+  size_t current = size_of(b);
+
+  if (current - size >= MIN_BLOCK) {
+    Block* rest = (Block*)((uint8_t*)b + size);
+    rest->size = (current - size) | INUSE | PREV_INUSE;
+    b->size = size | (header(b) & (INUSE | PREV_INUSE));
+    heap_free(rest);
+  }
+}
+
+// Thread caches: every thread keeps short LIFO lists of recently freed small
+// blocks, one per exact block size. Blocks on them still count as allocated
+// for the central heap, so a cache hit needs neither the lock nor any shared
+// state. Lists are refilled and drained in batches under a single lock.
+#define TCACHE_MAX 256    // Largest block size served from the caches
+#define TCACHE_COUNT 16   // Blocks kept per size before draining
+#define TCACHE_BINS ((int)((TCACHE_MAX - MIN_BLOCK) / ALIGNMENT) + 1)
+
+// Per-thread operation counters, summed up by c_malloc_stats()
+typedef struct {
+  _Atomic uint64_t allocs;
+  _Atomic uint64_t frees;
+  _Atomic uint64_t failed;
+} ThreadStats;
+
+typedef struct ThreadCache {
+  Block* bins[TCACHE_BINS];      // Cached blocks linked through 'next'
+  uint8_t counts[TCACHE_BINS];   // Number of blocks on each list
+  int registered;                // 1 once the exit destructor is armed,
+                                 // -1 after it ran while the thread exits
+  unsigned sample_countdown;     // Operations until the next timed one
+  int64_t profile_countdown;     // Bytes until the next profiled allocation
+  uint64_t profile_rng;          // State of the interval generator, 0 unset
+  ThreadStats stats;
+  struct ThreadCache* next;      // Registered caches, under HEAP_LOCK
+  struct ThreadCache* prev;
+} ThreadCache;
+
+// Initial-exec TLS never allocates on first access, which matters when this
+// file is built into a malloc replacement
+static _Thread_local ThreadCache TCACHE
+    __attribute__((tls_model("initial-exec")));
+static pthread_key_t TCACHE_KEY;
+static pthread_once_t TCACHE_ONCE = PTHREAD_ONCE_INIT;
+
+static ThreadCache* CACHES = NULL;  // Caches of all live threads
+static ThreadStats RETIRED;         // Counters of threads that have exited
+
+// Function to move up to 'count' blocks of cache bin 'i' back to the heap
+static void tcache_drain(ThreadCache* tc, int i, int count) {
+  pthread_mutex_lock(&HEAP_LOCK);
+  while (count-- > 0 && tc->bins[i] != NULL) {
+    Block* b = tc->bins[i];
+    tc->bins[i] = b->next;
+    --tc->counts[i];
+    heap_free(b);
+  }
+  pthread_mutex_unlock(&HEAP_LOCK);
+}
+
+// Function to return every cached block to the heap
+static void tcache_flush(ThreadCache* tc) {
+  for (int i = 0; i < TCACHE_BINS; ++i) {
+    tcache_drain(tc, i, TCACHE_COUNT);
+  }
+}
+
+// Function to flush a thread cache when its thread exits and keep its
+// counters. Other destructors may still allocate afterwards; that traffic
+// bypasses the cache and is no longer counted.
+static void tcache_destroy(void* arg) {
+  ThreadCache* tc = arg;
+  tcache_flush(tc);
+
+  pthread_mutex_lock(&HEAP_LOCK);
+  STAT_ADD(RETIRED.allocs, tc->stats.allocs);
+  STAT_ADD(RETIRED.frees, tc->stats.frees);
+  STAT_ADD(RETIRED.failed, tc->stats.failed);
+  if (tc->prev != NULL) {
+    tc->prev->next = tc->next;
+  } else {
+    CACHES = tc->next;
+  }
+  if (tc->next != NULL) {
+    tc->next->prev = tc->prev;
+  }
+  pthread_mutex_unlock(&HEAP_LOCK);
+
+  tc->registered = -1;
+}
+
+static void tcache_create_key() {
+  pthread_key_create(&TCACHE_KEY, tcache_destroy);
+}
+
+// Function to arm the exit destructor on a thread's first operation
+static void tcache_register(ThreadCache* tc) {
+  tc->registered = 1;  // pthread_setspecific() may allocate and recurse
+  pthread_once(&TCACHE_ONCE, tcache_create_key);
+  pthread_setspecific(TCACHE_KEY, tc);
+
+  pthread_mutex_lock(&HEAP_LOCK);
+  tc->prev = NULL;
+  tc->next = CACHES;
+  if (CACHES != NULL) {
+    CACHES->prev = tc;
+  }
+  CACHES = tc;
+  pthread_mutex_unlock(&HEAP_LOCK);
+}
+
+// Fork handlers keep the heap lock consistent in the child. The child's only
+// thread is the one that took the lock in fork_prepare(), so it unlocks it;
+// initializing a mutex that is still held is undefined.
+static void fork_prepare() { pthread_mutex_lock(&HEAP_LOCK); }
+static void fork_parent() { pthread_mutex_unlock(&HEAP_LOCK); }
+static void fork_child() {
+  pthread_mutex_unlock(&HEAP_LOCK);
+  DECAY_THREAD = 0;  // Only the forking thread survives
+}
+
+// pthread_atfork() may allocate, so it runs from a constructor rather than
+// from inside the allocator while the lock is held
+__attribute__((constructor)) static void register_fork_handlers() {
+  pthread_atfork(fork_prepare, fork_parent, fork_child);
+}
+
+// Function to serve a large request with a dedicated mapping. The header
+// records the length of the whole mapping.
+static void* mapped_malloc(size_t size) {
+  size = (size + ALIGNMENT + PAGE_SIZE - 1) & ~(size_t)(PAGE_SIZE - 1);
+
+  void* p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED) {
+    return NULL;
+  }
+
+  atomic_fetch_add_explicit(&LARGE_MAPPED, size, memory_order_relaxed);
+  update_peak();
+
+  Block* b = (Block*)((uint8_t*)p + MAPPED_HEADER);
+  b->size = size | MAPPED;
+  return (uint8_t*)b + HEADER;
+}
+
+// Function to serve a large request whose address must be a multiple of
+// 'alignment' with a dedicated mapping. The mapping is over-sized by the
+// alignment, then the whole pages in front of the header and behind the data
+// are unmapped again.
+static void* mapped_aligned_malloc(size_t alignment, size_t size) {
+  size_t length =
+      ((size + PAGE_SIZE - 1) & ~(size_t)(PAGE_SIZE - 1)) + alignment;
+
+  uint8_t* p = mmap(NULL, length, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED) {
+    return NULL;
+  }
+
+  uint8_t* user = (uint8_t*)(((uintptr_t)p + HEADER + alignment - 1) &
+                             ~(uintptr_t)(alignment - 1));
+  Block* b = (Block*)(user - HEADER);
+  uint8_t* start = mapping_of(b);
+  uint8_t* end = (uint8_t*)(((uintptr_t)user + size + PAGE_SIZE - 1) &
+                            ~(uintptr_t)(PAGE_SIZE - 1));
+
+  if (start != p) {
+    munmap(p, start - p);
+  }
+  if (end != p + length) {
+    munmap(end, p + length - end);
+  }
+
+  atomic_fetch_add_explicit(&LARGE_MAPPED, end - start, memory_order_relaxed);
+  update_peak();
+
+  b->size = (size_t)(end - start) | MAPPED;
+  return user;
+}
+
+// Function to allocate a block, from the thread cache when possible
+static void* malloc_impl(ThreadCache* tc, size_t size) {
+  // Large requests bypass the heap, which also rejects sizes that would
+  // overflow once the header is added
+  if (size >= MMAP_THRESHOLD) {
+    return size <= SIZE_MAX / 2 ? mapped_malloc(size) : NULL;
+  }
+
+  size = block_size(size);  // Include header size for metadata
+
+  if (size > TCACHE_MAX || tc->registered < 0) {
+    pthread_mutex_lock(&HEAP_LOCK);
+    Block* b = heap_malloc(size);
+    pthread_mutex_unlock(&HEAP_LOCK);
+    return b != NULL ? (uint8_t*)b + HEADER : NULL;
+  }
+
+  int i = (int)((size - MIN_BLOCK) / ALIGNMENT);
+
+  // Refill an empty list with half a cache worth of blocks in one go
+  if (tc->bins[i] == NULL) {
+    pthread_mutex_lock(&HEAP_LOCK);
+    for (int n = 0; n < TCACHE_COUNT / 2; ++n) {
+      Block* b = heap_malloc(size);
+      if (b == NULL) {
+        break;
+      }
+      b->next = tc->bins[i];
+      tc->bins[i] = b;
+      ++tc->counts[i];
+    }
+    pthread_mutex_unlock(&HEAP_LOCK);
+
+    if (tc->bins[i] == NULL) {
+      return NULL;  // Allocation failed
+    }
+  }
+
+  Block* b = tc->bins[i];
+  tc->bins[i] = b->next;
+  --tc->counts[i];
+
+  return (uint8_t*)b + HEADER;  // Return the user-accessible pointer
+}
+
+// Function to release a block, into the thread cache when possible
+static void free_impl(ThreadCache* tc, void* ptr) {
+  Block* b = (Block*)((uint8_t*)ptr - HEADER);  // Start of memory block
+
+  // Dedicated mappings go straight back to the OS
+  if (header(b) & MAPPED) {
+    size_t size = mapped_size(b);
+    munmap(mapping_of(b), size);
+    atomic_fetch_sub_explicit(&LARGE_MAPPED, size, memory_order_relaxed);
+    return;
+  }
+
+  if (size_of(b) > TCACHE_MAX || tc->registered < 0) {
+    pthread_mutex_lock(&HEAP_LOCK);
+    heap_free(b);
+    pthread_mutex_unlock(&HEAP_LOCK);
+    return;
+  }
+
+  int i = (int)((size_of(b) - MIN_BLOCK) / ALIGNMENT);
+
+  // Keep the block for this thread, draining half the list when it is full
+  if (tc->counts[i] >= TCACHE_COUNT) {
+    tcache_drain(tc, i, TCACHE_COUNT / 2);
+  }
+
+  b->next = tc->bins[i];
+  tc->bins[i] = b;
+  ++tc->counts[i];
+}
+
+// Function to check whether any instrumentation is on; one predictable
+// branch
+static inline int hooked() {
+  return __builtin_expect(
+      atomic_load_explicit(&HOOKS, memory_order_relaxed) != 0, 0);
+}
+
+// Function to switch one of the HOOK_* bits on or off
+void heap_set_hook(unsigned hook, int on) {
+  if (on) {
+    atomic_fetch_or_explicit(&HOOKS, hook, memory_order_relaxed);
+  } else {
+    atomic_fetch_and_explicit(&HOOKS, ~hook, memory_order_relaxed);
+  }
+}
+
+// Function to decide whether this operation is one of the timed samples
+static int sample_due(ThreadCache* tc) {
+  if (tc->sample_countdown-- != 0) {
+    return 0;
+  }
+  tc->sample_countdown =
+      atomic_load_explicit(&SAMPLE_EVERY, memory_order_relaxed) - 1;
+  return 1;
+}
+
+// Function to add a timed operation to a latency histogram
+static void record_latency(_Atomic uint64_t* histogram, uint64_t ns) {
+  int bucket = 63 - __builtin_clzll(ns | 1);
+  if (bucket >= C_MALLOC_LATENCY_BUCKETS) {
+    bucket = C_MALLOC_LATENCY_BUCKETS - 1;
+  }
+  atomic_fetch_add_explicit(&histogram[bucket], 1, memory_order_relaxed);
+}
+
+// Function to count an allocation against the thread's profile interval
+// and record it once the interval is used up
+__attribute__((always_inline)) static inline void profile_note(
+    ThreadCache* tc, void* p, size_t size) {
+  if (tc->profile_rng == 0) {
+    tc->profile_rng = ((uintptr_t)tc * 0x9E3779B97F4A7C15ull) ^ now_ns();
+    tc->profile_rng |= 1;
+    tc->profile_countdown = profile_interval(&tc->profile_rng);
+  }
+
+  tc->profile_countdown -= (int64_t)size;
+  if (tc->profile_countdown > 0) {
+    return;
+  }
+  while (tc->profile_countdown <= 0) {
+    tc->profile_countdown += profile_interval(&tc->profile_rng);
+  }
+
+  if (profile_add(p, size)) {
+    Block* b = (Block*)((uint8_t*)p - HEADER);
+    __atomic_fetch_or(&b->size, SAMPLED, __ATOMIC_RELAXED);
+  }
+}
+
+// Function to take a block out of the heap profile before it is released.
+// The bit is cleared even when the profiler has stopped since the block was
+// sampled; profile_remove() then finds nothing to drop.
+static inline void profile_forget(void* ptr) {
+  Block* b = (Block*)((uint8_t*)ptr - HEADER);
+  if (header(b) & SAMPLED) {
+    profile_remove(ptr);
+    __atomic_fetch_and(&b->size, ~(size_t)SAMPLED, __ATOMIC_RELAXED);
+  }
+}
+
+// Function to allocate with instrumentation on: the call may be timed, and
+// the block may be sampled for the heap profile. Kept out of line so the
+// uninstrumented path stays small.
+__attribute__((noinline)) PROFILE_ENTRY static void* malloc_hooked(
+    ThreadCache* tc, size_t size) {
+  unsigned hooks = atomic_load_explicit(&HOOKS, memory_order_relaxed);
+
+  void* p;
+  if ((hooks & HOOK_LATENCY) && sample_due(tc)) {
+    uint64_t start = now_ns();
+    p = malloc_impl(tc, size);
+    record_latency(MALLOC_LATENCY, now_ns() - start);
+  } else {
+    p = malloc_impl(tc, size);
+  }
+
+  if ((hooks & HOOK_PROFILE) && p != NULL) {
+    profile_poll();
+    profile_note(tc, p, size);
+  }
+  return p;
+}
+
+// Function to free with instrumentation on
+static void free_hooked(ThreadCache* tc, void* ptr) {
+  profile_forget(ptr);
+
+  if ((atomic_load_explicit(&HOOKS, memory_order_relaxed) & HOOK_LATENCY) &&
+      sample_due(tc)) {
+    uint64_t start = now_ns();
+    free_impl(tc, ptr);
+    record_latency(FREE_LATENCY, now_ns() - start);
+  } else {
+    free_impl(tc, ptr);
+  }
+}
+
+// Function to allocate memory of a given size
+PROFILE_ENTRY void* c_malloc(size_t size) {
+  ThreadCache* tc = &TCACHE;
+  if (tc->registered == 0) {
+    tcache_register(tc);
+  }
+
+  void* p = hooked() ? malloc_hooked(tc, size) : malloc_impl(tc, size);
+
+  if (p != NULL) {
+    STAT_ADD(tc->stats.allocs, 1);
+  } else {
+    STAT_ADD(tc->stats.failed, 1);
+  }
+  return p;
+}
+
+// Function to free previously allocated memory
+void c_free(void* ptr) {
+  // Check if the pointer is real
+  if (ptr == NULL) {
+    return;
+  }
+
+  ThreadCache* tc = &TCACHE;
+  if (tc->registered == 0) {
+    tcache_register(tc);
+  }
+
+  if (hooked()) {
+    free_hooked(tc, ptr);
+  } else {
+    free_impl(tc, ptr);
+  }
+
+  STAT_ADD(tc->stats.frees, 1);
+}
+
+// Function to allocate zeroed memory for an array
+PROFILE_ENTRY void* c_calloc(size_t count, size_t size) {
+  size_t total;
+  if (__builtin_mul_overflow(count, size, &total)) {
+    return NULL;
+  }
+
+  uint8_t* p = c_malloc(total);
+  if (p == NULL) {
+    return NULL;
+  }
+
+  // Fresh mappings are already zero
+  if (!(header((Block*)(p - HEADER)) & MAPPED)) {
+    memset(p, 0, total);
+  }
+  return p;
+}
+
+// Function to carve a block whose user pointer is a multiple of 'alignment'
+// out of the central heap. The block is over-allocated by the alignment; the
+// space in front of the aligned pointer becomes a free block of its own and
+// the tail is trimmed, so only the rounding of the size is lost.
+static void* aligned_impl(size_t alignment, size_t size) {
+  if (size + alignment >= MMAP_THRESHOLD) {
+    return mapped_aligned_malloc(alignment, size);
+  }
+
+  size = block_size(size);
+
+  pthread_mutex_lock(&HEAP_LOCK);
+  Block* b = heap_malloc(size + alignment + MIN_BLOCK);
+  if (b == NULL) {
+    pthread_mutex_unlock(&HEAP_LOCK);
+    return NULL;
+  }
+
+  // The leading gap must be empty or big enough to be a block itself
+  uintptr_t user = (uintptr_t)b + HEADER;
+  size_t lead = (size_t)(-user & (alignment - 1));
+  if (lead != 0 && lead < MIN_BLOCK) {
+    lead += alignment;
+  }
+
+  if (lead != 0) {
+    Block* aligned = (Block*)((uint8_t*)b + lead);
+    aligned->size = (size_of(b) - lead) | INUSE | PREV_INUSE;
+    b->size = lead | (header(b) & (INUSE | PREV_INUSE));
+    heap_free(b);
+    b = aligned;
+  }
+  heap_trim(b, size);
+  pthread_mutex_unlock(&HEAP_LOCK);
+
+  return (uint8_t*)b + HEADER;
+}
+
+// Function to allocate memory whose address is a multiple of 'alignment',
+// which must be a power of two. Every c_malloc() pointer is already aligned
+// to ALIGNMENT; stricter alignments are carved out of the heap or, for large
+// requests, out of a dedicated mapping.
+PROFILE_ENTRY void* c_aligned_alloc(size_t alignment, size_t size) {
+  if (alignment <= ALIGNMENT) {
+    return c_malloc(size);
+  }
+
+  ThreadCache* tc = &TCACHE;
+  if (tc->registered == 0) {
+    tcache_register(tc);
+  }
+
+  void* p = NULL;
+  if (alignment <= SIZE_MAX / 4 && size <= SIZE_MAX / 4) {
+    p = aligned_impl(alignment, size);
+  }
+
+  if (hooked() && p != NULL &&
+      (atomic_load_explicit(&HOOKS, memory_order_relaxed) & HOOK_PROFILE)) {
+    profile_note(tc, p, size);
+  }
+
+  if (p != NULL) {
+    STAT_ADD(tc->stats.allocs, 1);
+  } else {
+    STAT_ADD(tc->stats.failed, 1);
+  }
+  return p;
+}
+
+// Function to report how many bytes can be used through a pointer
+size_t c_malloc_usable_size(void* ptr) {
+  if (ptr == NULL) {
+    return 0;
+  }
+
+  Block* b = (Block*)((uint8_t*)ptr - HEADER);
+
+  if (header(b) & MAPPED) {
+    return mapped_size(b) - ((uint8_t*)ptr - mapping_of(b));
+  }
+  return size_of(b) - HEADER;
+}
+
+// Function to resize a heap block in place: shrinking splits off the tail,
+// growing absorbs the physically next block when it is free and big enough.
+// Returns 0 when the block has to move instead.
+static int heap_resize(Block* b, size_t size) {
+  int resized = 1;
+
+  pthread_mutex_lock(&HEAP_LOCK);
+
+  size_t current = size_of(b);
+  Block* after = next_block(b);
+
+  if (current < size) {
+    if (!(header(after) & INUSE) && current + size_of(after) >= size) {
+      bin_remove(after);
+      current += size_of(after);
+      b->size = current | (header(b) & (INUSE | PREV_INUSE));
+      set_next_prev_inuse(b, 1);
+      STAT_ADD(HEAP_IN_USE, size_of(after));
+      update_peak();
+    } else {
+      resized = 0;
+    }
+  }
+
+  if (resized) {
+    heap_trim(b, size);
+  }
+
+  pthread_mutex_unlock(&HEAP_LOCK);
+  return resized;
+}
+
+// Function to change the size of an allocation, in place whenever possible
+PROFILE_ENTRY void* c_realloc(void* ptr, size_t size) {
+  if (ptr == NULL) {
+    return c_malloc(size);
+  }
+  if (size == 0) {
+    c_free(ptr);
+    return NULL;
+  }
+  if (size > SIZE_MAX / 2) {
+    return NULL;
+  }
+
+  // Resizing rewrites the header, so a sampled block leaves the profile;
+  // when the data moves, the new block may be sampled again
+  if (hooked()) {
+    profile_forget(ptr);
+  }
+
+  Block* b = (Block*)((uint8_t*)ptr - HEADER);
+
+  if (header(b) & MAPPED) {
+    // Large blocks stay mapped; the kernel moves their pages, not the data.
+    // The header keeps its offset into the first page, and so its alignment.
+    if (size >= MMAP_THRESHOLD) {
+      uint8_t* start = mapping_of(b);
+      size_t offset = (uint8_t*)b - start;
+      size_t old = mapped_size(b);
+      size_t mapped = (size + offset + HEADER + PAGE_SIZE - 1) &
+                      ~(size_t)(PAGE_SIZE - 1);
+      if (mapped == old) {
+        return ptr;
+      }
+      uint8_t* p = mremap(start, old, mapped, MREMAP_MAYMOVE);
+      if (p == MAP_FAILED) {
+        return NULL;
+      }
+      atomic_fetch_add_explicit(&LARGE_MAPPED, mapped - old,
+                                memory_order_relaxed);
+      update_peak();
+      b = (Block*)(p + offset);
+      b->size = mapped | MAPPED;
+      return (uint8_t*)b + HEADER;
+    }
+  } else if (size < MMAP_THRESHOLD && heap_resize(b, block_size(size))) {
+    return ptr;
+  }
+
+  // Fall back to moving the data
+  void* p = c_malloc(size);
+  if (p != NULL) {
+    size_t usable = c_malloc_usable_size(ptr);
+    memcpy(p, ptr, usable < size ? usable : size);
+    c_free(ptr);
+  }
+  return p;
+}
+
+// Function to return the calling thread's cached blocks to the central heap
+void c_malloc_flush_thread_cache() {
+  tcache_flush(&TCACHE);
+}
+
+// Function to count the resident pages of all heap chunks with mincore().
+// The caller must hold HEAP_LOCK, which also guards the page vector.
+static size_t heap_resident() {
+  static unsigned char pages[1024];
+  size_t resident = 0;
+
+  for (Chunk* c = CHUNKS; c != NULL; c = c->next) {
+    for (size_t offset = 0; offset < c->size;
+         offset += sizeof(pages) * PAGE_SIZE) {
+      size_t length = c->size - offset;
+      if (length > sizeof(pages) * PAGE_SIZE) {
+        length = sizeof(pages) * PAGE_SIZE;
+      }
+      if (mincore((uint8_t*)c + offset, length, pages) != 0) {
+        continue;
+      }
+      for (size_t i = 0; i < length / PAGE_SIZE; ++i) {
+        resident += (pages[i] & 1) * PAGE_SIZE;
+      }
+    }
+  }
+  return resident;
+}
+
+// Function to take a snapshot of the allocator statistics
+void c_malloc_stats(CMallocStats* stats) {
+  memset(stats, 0, sizeof(*stats));
+
+  pthread_mutex_lock(&HEAP_LOCK);
+  stats->allocs = RETIRED.allocs;
+  stats->frees = RETIRED.frees;
+  stats->failed_allocs = RETIRED.failed;
+  for (ThreadCache* tc = CACHES; tc != NULL; tc = tc->next) {
+    stats->allocs += atomic_load_explicit(&tc->stats.allocs,
+                                          memory_order_relaxed);
+    stats->frees += atomic_load_explicit(&tc->stats.frees,
+                                         memory_order_relaxed);
+    stats->failed_allocs += atomic_load_explicit(&tc->stats.failed,
+                                                 memory_order_relaxed);
+  }
+  stats->heap_mapped = HEAP_MAPPED;
+  stats->heap_committed = HEAP_MAPPED - DECOMMITTED_BYTES;
+  stats->heap_resident = heap_resident();
+  stats->free_blocks = IN_USE;
+  stats->decommits = DECOMMITS;
+  stats->decommitted_bytes = DECOMMITTED_TOTAL;
+  pthread_mutex_unlock(&HEAP_LOCK);
+
+  stats->coalesces = atomic_load_explicit(&COALESCES, memory_order_relaxed);
+  stats->large_mapped =
+      atomic_load_explicit(&LARGE_MAPPED, memory_order_relaxed);
+  stats->bytes_in_use =
+      atomic_load_explicit(&HEAP_IN_USE, memory_order_relaxed) +
+      stats->large_mapped;
+  stats->peak_bytes_in_use =
+      atomic_load_explicit(&PEAK_IN_USE, memory_order_relaxed);
+
+  for (int i = 0; i < C_MALLOC_LATENCY_BUCKETS; ++i) {
+    stats->malloc_latency[i] =
+        atomic_load_explicit(&MALLOC_LATENCY[i], memory_order_relaxed);
+    stats->free_latency[i] =
+        atomic_load_explicit(&FREE_LATENCY[i], memory_order_relaxed);
   }
-  printf("Entities in use:[%d]\n", IN_USE);
 }
 
-// Function to find or create a new memory entity for allocation
-Entity* new_entity(size_t size) {
-  // If the first entity is unused, initialize it with heap memory
-  if (LIST[0].ptr == NULL && LIST[0].size == 0) {
-    static VirtualMemory vm;
-    LIST[0].ptr = vm.heap;
-    LIST[0].size = HEAP_SIZE;
-    ++IN_USE;
-    LOG();
-  }
+// Function to time every n-th c_malloc/c_free call of each thread, or none
+// when 'every' is 0
+void c_malloc_sample_latency(unsigned every) {
+  atomic_store_explicit(&SAMPLE_EVERY, every, memory_order_relaxed);
+  heap_set_hook(HOOK_LATENCY, every != 0);
+}
 
-  // Find the best fit memory entity that can accommodate 'size'
-  Entity* best = NULL;
-  uint16_t best_size = UINT16_MAX;
+// Function to decommit free heap pages, largest free blocks first, until at
+// most 'pad' bytes of free pages stay committed. The calling thread's cache
+// is flushed first so its blocks can merge.
+size_t c_malloc_trim(size_t pad) {
+  tcache_flush(&TCACHE);
 
-  for (int i = 0; i < IN_USE; ++i) {
-    if (LIST[i].size >= size && LIST[i].size < best_size) {
-      best = &LIST[i];
-      best_size = LIST[i].size;
+  pthread_mutex_lock(&HEAP_LOCK);
+
+  size_t committed = 0;
+  for (int i = 0; i < BIN_COUNT; ++i) {
+    for (Block* b = BINS[i]; b != NULL; b = b->next) {
+      uint8_t* start;
+      if (!(b->size & DECOMMITTED)) {
+        committed += decommit_span(b, &start);
+      }
     }
   }
 
-  // If no suitable entity is found, return NULL
-  if (best == NULL) {
-    return NULL;
+  size_t released = 0;
+  for (int i = BIN_COUNT - 1; i >= 0 && committed > pad; --i) {
+    for (Block* b = BINS[i]; b != NULL && committed > pad; b = b->next) {
+      size_t span = decommit(b);
+      committed -= span;
+      released += span;
+    }
   }
 
-  return best;
+  pthread_mutex_unlock(&HEAP_LOCK);
+  return released;
 }
 
-// Function to allocate memory of a given size
-void* c_malloc(size_t size) {
-  // Check if the requested size exceeds the maximum heap size
-  if (size > HEAP_SIZE - HEADER) {
-    return NULL;
-  }
-
-  size += HEADER;  // Include header size for metadata
+// Function run by the decay thread: a decay pass every half decay time,
+// until decay is switched off
+static void* decay_thread(void* arg) {
+  (void)arg;
 
-  // Try to find or create a suitable memory entity for allocation
-  Entity* e = new_entity(size);
+  for (;;) {
+    pthread_mutex_lock(&HEAP_LOCK);
+    uint64_t decay = atomic_load_explicit(&DECAY_NS, memory_order_relaxed);
+    if (decay == 0) {
+      DECAY_THREAD = 0;
+      pthread_mutex_unlock(&HEAP_LOCK);
+      return NULL;
+    }
+    heap_decay(now_ns());
+    pthread_mutex_unlock(&HEAP_LOCK);
 
-  if (e == NULL) {
-    return NULL;  // Allocation failed
+    uint64_t pause = decay / 2;
+    struct timespec ts = {(time_t)(pause / 1000000000u),
+                          (long)(pause % 1000000000u)};
+    nanosleep(&ts, NULL);
   }
+}
 
-  uint8_t* start = e->ptr;             // Start of allocated memory
-  uint8_t* user_ptr = start + HEADER;  // User-accessible pointer
-
-  *((uint16_t*)start) = size;  // Store the size at the beginning
+// Function to decommit free heap memory once it has been idle for
+// 'decay_ms', or never when it is 0. The check runs when large blocks are
+// freed; 'background' adds a thread that also covers idle periods.
+void c_malloc_set_decay(unsigned decay_ms, int background) {
+  atomic_store_explicit(&DECAY_NS, (uint64_t)decay_ms * 1000000u,
+                        memory_order_relaxed);
+  if (decay_ms == 0 || !background) {
+    return;
+  }
 
-  e->ptr += size;   // Move the entity pointer forward
-  e->size -= size;  // Reduce the entity size
+  // pthread_create() allocates, so the lock is not held while it runs
+  pthread_mutex_lock(&HEAP_LOCK);
+  int start = !DECAY_THREAD;
+  DECAY_THREAD = 1;
+  pthread_mutex_unlock(&HEAP_LOCK);
 
-  // If the entity is fully used up, remove it from the list
-  if (e->size == 0) {
-    for (int i = 0; i < IN_USE; ++i) {
-      if (&LIST[i] == e) {
-        LIST[i] = LIST[IN_USE - 1];
-        break;
-      }
+  if (start) {
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&thread, &attr, decay_thread, NULL) != 0) {
+      pthread_mutex_lock(&HEAP_LOCK);
+      DECAY_THREAD = 0;
+      pthread_mutex_unlock(&HEAP_LOCK);
     }
-    --IN_USE;
+    pthread_attr_destroy(&attr);
   }
-
-  LOG();  // Log the current state of memory
-
-  return user_ptr;  // Return the user-accessible pointer
 }
 
-// Function to free previously allocated memory
-void c_free(void* ptr) {
-  // Check if the pointer is real
-  if (ptr == NULL) {
-    return;
-  }
-
-  uint8_t* start = (uint8_t*)ptr - HEADER;  // Start of memory block
-  uint16_t size = *((uint16_t*)start);      // Size of memory block
+_Static_assert(MAP_PAGE == PAGE_SIZE, "the heap map counts heap pages");
+_Static_assert(C_MALLOC_SIZE_CLASSES == BIN_COUNT, "one class per bin");
 
-  assert(size > HEADER);  // Ensure size is greater than HEADER
+// Function to visit every chunk and block of the central heap, each chunk
+// followed by its blocks in address order
+void heap_walk(void (*visit)(const HeapSpan* span, void* arg), void* arg) {
+  pthread_mutex_lock(&HEAP_LOCK);
 
-  int insert_index = IN_USE;  // Index to insert freed block
+  for (Chunk* c = CHUNKS; c != NULL; c = c->next) {
+    HeapSpan span = {SPAN_CHUNK, 0, (uintptr_t)c, c->size, 0, 0};
+    visit(&span, arg);
 
-  // Check if we can merge with the block before
-  for (int i = 0; i < IN_USE; ++i) {
-    if (LIST[i].ptr + LIST[i].size == start) {
-      LIST[i].size += size;
-      start = LIST[i].ptr;
-      size = LIST[i].size;
-      insert_index = i;
-      break;
-    }
-  }
-
-  // Check if we can merge with the block after
-  if (insert_index == IN_USE) {
-    for (int i = 0; i < IN_USE; ++i) {
-      if (start + size == LIST[i].ptr) {
-        start = LIST[i].ptr;
-        size += LIST[i].size;
-        insert_index = i;
-        break;
+    for (Block* b = chunk_first(c); size_of(b) != 0; b = next_block(b)) {
+      size_t flags = header(b);
+      span.kind = (flags & INUSE) ? SPAN_USED : SPAN_FREE;
+      span.size_class = bin_index(size_of(b));
+      span.start = (uintptr_t)b;
+      span.size = size_of(b);
+      span.released = 0;
+      span.released_size = 0;
+      if (span.kind == SPAN_FREE && (flags & DECOMMITTED)) {
+        uint8_t* start;
+        span.released_size = decommit_span(b, &start);
+        span.released = (uintptr_t)start;
       }
+      visit(&span, arg);
     }
   }
 
-  // If no merge happened, insert the block as a new entry
-  if (insert_index == IN_USE) {
-    LIST[IN_USE].ptr = start;
-    LIST[IN_USE].size = size;
-    ++IN_USE;
-  } else {
-    // Adjust the merged block size in the list
-    LIST[insert_index].ptr = start;
-    LIST[insert_index].size = size;
-  }
+  pthread_mutex_unlock(&HEAP_LOCK);
+}
 
-  // Compact the list by removing empty entries
-  for (int i = 0; i < IN_USE - 1; ++i) {
-    if (LIST[i].ptr + LIST[i].size == LIST[i + 1].ptr) {
-      LIST[i].size += LIST[i + 1].size;
-      for (int j = i + 1; j < IN_USE - 1; ++j) {
-        LIST[j] = LIST[j + 1];
-      }
-      --IN_USE;
-    }
+// Function to find the smallest block size of a size class, the inverse of
+// bin_index()
+size_t heap_class_size(int size_class) {
+  if (size_class < (int)SMALL_BINS) {
+    return MIN_BLOCK + (size_t)size_class * ALIGNMENT;
   }
 
-  LOG();  // Log the current state of memory
+  int range = size_class - (int)SMALL_BINS;
+  int shift = SMALL_SHIFT + (range >> SUB_BITS);
+  size_t sub = (size_t)(range & ((1 << SUB_BITS) - 1));
+  return ((size_t)1 << shift) + (sub << (shift - SUB_BITS));
 }
 
+#ifndef C_MALLOC_LIBRARY
+
 // Test function demonstrating memory allocation and deallocation
 void test() {
   // Define a structure with integer and double members
@@ -197,13 +1345,13 @@ void test() {
   printf("Address: [%p], data: [%d]\n", (void*)bazz, *bazz);
 
   // Free allocated memory blocks
-  c_free(foo);
   c_free(bar);
   c_free(bazz);
 
   // Allocate memory for a double and copy data from Foo structure
   double* fizz = (double*)c_malloc(sizeof(double));
   memcpy(fizz, &foo->b, sizeof(double));
+  c_free(foo);
 
   // Print allocated double data
   printf("Address: [%p], data: [%e]\n", (void*)fizz, *fizz);
@@ -212,7 +1360,870 @@ void test() {
   c_free(fizz);
 }
 
-int main(int argc, char** argv) {
+// Benchmark showing that allocation latency does not grow with the number of
+// free blocks: the heap is cut into 'holes' small free blocks separated by
+// live spacers, then allocations of mixed sizes are timed on top of that.
+// It drives the central heap directly so thread caches do not absorb the
+// traffic.
+void benchmark_bins() {
+  enum { MAX_HOLES = 8192, ROUNDS = 100000 };
+  static Block* spacers[MAX_HOLES];
+  static Block* scratch[MAX_HOLES];
+  const int counts[] = {16, 128, 1024, 4096, MAX_HOLES};
+  const size_t sizes[] = {16, 100, 1000, 24};
+
+  printf("Allocation latency by number of free blocks:\n");
+
+  for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); ++c) {
+    int holes = counts[c];
+
+    pthread_mutex_lock(&HEAP_LOCK);
+
+    // Fragment the heap: every other block is freed again
+    for (int i = 0; i < holes; ++i) {
+      scratch[i] = heap_malloc(block_size(24));
+      spacers[i] = heap_malloc(block_size(24));
+    }
+    for (int i = 0; i < holes; ++i) {
+      heap_free(scratch[i]);
+    }
+
+    uint64_t total = 0;
+    for (int i = 0; i < ROUNDS; ++i) {
+      size_t size = sizes[i % (sizeof(sizes) / sizeof(sizes[0]))];
+
+      uint64_t start = now_ns();
+      Block* b = heap_malloc(block_size(size));
+      total += now_ns() - start;
+
+      assert(b != NULL);
+      heap_free(b);
+    }
+
+    size_t free_blocks = IN_USE;
+
+    for (int i = 0; i < holes; ++i) {
+      heap_free(spacers[i]);
+    }
+
+    pthread_mutex_unlock(&HEAP_LOCK);
+    printf("Free blocks: [%5zu] avg alloc: [%.1f ns]\n", free_blocks,
+           (double)total / ROUNDS);
+  }
+}
+
+// Test function for a working set far beyond a single chunk: a few hundred
+// MB of heap blocks plus several dedicated mappings for large buffers
+void test_large() {
+  enum { BLOCKS = 2000, BUFFERS = 4 };
+  static uint8_t* blocks[BLOCKS];
+  uint8_t* buffers[BUFFERS];
+  const size_t block = 100 * 1024;
+  const size_t buffer = 32 << 20;
+
+  for (int i = 0; i < BLOCKS; ++i) {
+    blocks[i] = c_malloc(block);
+    assert(blocks[i] != NULL);
+    blocks[i][0] = blocks[i][block - 1] = (uint8_t)i;
+  }
+  for (int i = 0; i < BUFFERS; ++i) {
+    buffers[i] = c_malloc(buffer);
+    assert(buffers[i] != NULL);
+    assert(((Block*)(buffers[i] - HEADER))->size & MAPPED);
+    buffers[i][0] = buffers[i][buffer - 1] = (uint8_t)i;
+  }
+
+  printf("Heap chunks: [%zu] mapped: [%zu MB]\n", CHUNK_COUNT,
+         HEAP_MAPPED >> 20);
+
+  for (int i = 0; i < BUFFERS; ++i) {
+    assert(buffers[i][0] == (uint8_t)i && buffers[i][buffer - 1] == (uint8_t)i);
+    c_free(buffers[i]);
+  }
+  for (int i = 0; i < BLOCKS; ++i) {
+    assert(blocks[i][0] == (uint8_t)i && blocks[i][block - 1] == (uint8_t)i);
+    c_free(blocks[i]);
+  }
+}
+
+// Function to check the heap invariants: every chunk is tiled by blocks up to
+// its epilogue, the boundary tags agree with each other, no two free blocks
+// are adjacent and exactly the free blocks sit on the bin of their size.
+// The caller must hold HEAP_LOCK.
+static void heap_check() {
+  size_t free_blocks = 0;
+  size_t decommitted = 0;
+
+  for (Chunk* c = CHUNKS; c != NULL; c = c->next) {
+    uint8_t* end = (uint8_t*)c + c->size - HEADER;
+    Block* b = chunk_first(c);
+    int prev_inuse = 1;
+
+    while (size_of(b) != 0) {
+      assert(size_of(b) >= MIN_BLOCK && size_of(b) % ALIGNMENT == 0);
+      assert((uint8_t*)next_block(b) <= end);
+      assert(!(b->size & PREV_INUSE) == !prev_inuse);
+
+      if (!(b->size & INUSE)) {
+        assert(prev_inuse);  // Free neighbors must have been merged
+        assert(((size_t*)next_block(b))[-1] == size_of(b));
+        ++free_blocks;
+        if (b->size & DECOMMITTED) {
+          uint8_t* start;
+          decommitted += decommit_span(b, &start);
+        }
+      }
+      prev_inuse = b->size & INUSE;
+      b = next_block(b);
+    }
+
+    assert((uint8_t*)b == end && (b->size & INUSE));
+    assert(!(b->size & PREV_INUSE) == !prev_inuse);
+  }
+
+  size_t listed = 0;
+  for (int i = 0; i < BIN_COUNT; ++i) {
+    assert(!(BIN_MAP & ((uint64_t)1 << i)) == (BINS[i] == NULL));
+    for (Block* b = BINS[i]; b != NULL; b = b->next) {
+      assert(!(b->size & INUSE) && bin_index(size_of(b)) == i);
+      assert(b->prev != NULL ? b->prev->next == b : BINS[i] == b);
+      ++listed;
+    }
+  }
+  assert(listed == free_blocks && listed == IN_USE);
+  assert(decommitted == DECOMMITTED_BYTES);
+}
+
+// Stress test for the boundary tags: random interleavings of central heap
+// allocations and frees over a wide size range, checking the heap invariants
+// and the contents of every live block after each operation
+void test_heap_invariants() {
+  enum { LIVE = 256, OPS = 20000 };
+  Block* live[LIVE] = {0};
+  uint32_t seed = 12345;
+
+  pthread_mutex_lock(&HEAP_LOCK);
+
+  for (int op = 0; op < OPS; ++op) {
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+
+    int slot = seed % LIVE;
+    if (live[slot] == NULL) {
+      // Mostly small blocks, with the odd one large enough to need a chunk
+      size_t size = (seed >> 12) % ((seed >> 8) % 16 ? 2048 : 65536);
+      live[slot] = heap_malloc(block_size(size));
+      assert(live[slot] != NULL);
+      memset(live[slot] + 1, slot, size_of(live[slot]) - sizeof(Block));
+    } else {
+      uint8_t* data = (uint8_t*)(live[slot] + 1);
+      assert(data[0] == (uint8_t)slot);
+      heap_free(live[slot]);
+      live[slot] = NULL;
+    }
+
+    heap_check();
+  }
+
+  for (int i = 0; i < LIVE; ++i) {
+    if (live[i] != NULL) {
+      heap_free(live[i]);
+      heap_check();
+    }
+  }
+
+  pthread_mutex_unlock(&HEAP_LOCK);
+  printf("Heap invariants held over [%d] operations\n", OPS);
+}
+
+// Test function for c_realloc: growth into a free neighbor, shrinking in
+// place, growth that has to move, and the switch to a dedicated mapping,
+// checking the contents and the heap invariants along the way
+void test_realloc() {
+  uint8_t* a = c_realloc(NULL, 1000);
+  uint8_t* fence = c_malloc(1000);
+  memset(a, 0xAB, 1000);
+
+  // Free the fence so 'a' has room to grow into
+  c_free(fence);
+  uint8_t* grown = c_realloc(a, 1900);
+  assert(grown == a);
+
+  uint8_t* shrunk = c_realloc(grown, 500);
+  assert(shrunk == a);
+  for (int i = 0; i < 500; ++i) {
+    assert(shrunk[i] == 0xAB);
+  }
+
+  // A live neighbor forces the block to move
+  fence = c_malloc(1000);
+  uint8_t* moved = c_realloc(shrunk, 4000);
+  for (int i = 0; i < 500; ++i) {
+    assert(moved[i] == 0xAB);
+  }
+
+  // Growing past the threshold moves the data into its own mapping
+  uint8_t* mapped = c_realloc(moved, 4 * MMAP_THRESHOLD);
+  assert(((Block*)(mapped - HEADER))->size & MAPPED);
+  mapped = c_realloc(mapped, 16 * MMAP_THRESHOLD);
+  for (int i = 0; i < 500; ++i) {
+    assert(mapped[i] == 0xAB);
+  }
+
+  c_free(mapped);
+  c_free(fence);
+
+  pthread_mutex_lock(&HEAP_LOCK);
+  heap_check();
+  pthread_mutex_unlock(&HEAP_LOCK);
+
+  printf("Realloc test passed\n");
+}
+
+// Test function for the alignment guarantees: every c_malloc() pointer is
+// 16-byte aligned, and c_aligned_alloc() serves 64-byte and page alignment
+// from the heap and from dedicated mappings while giving the padding back
+void test_alignment() {
+  enum { COUNT = 64 };
+  static const size_t alignments[] = {64, 4096};
+  static const size_t sizes[] = {1, 24, 100, 1000, 5000, 60000,
+                                 MMAP_THRESHOLD, 3 * MMAP_THRESHOLD + 5};
+  void* blocks[COUNT];
+
+  c_malloc_flush_thread_cache();
+  size_t heap_before = atomic_load(&HEAP_IN_USE);
+  size_t mapped_before = atomic_load(&LARGE_MAPPED);
+
+  for (size_t size = 0; size < 2 * MMAP_THRESHOLD; size = size * 2 + 7) {
+    for (int i = 0; i < COUNT; ++i) {
+      blocks[i] = c_malloc(size);
+      assert(((uintptr_t)blocks[i] & (ALIGNMENT - 1)) == 0);
+    }
+    for (int i = 0; i < COUNT; ++i) {
+      c_free(blocks[i]);
+    }
+  }
+
+  for (size_t a = 0; a < sizeof(alignments) / sizeof(*alignments); ++a) {
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(*sizes); ++s) {
+      size_t alignment = alignments[a];
+      size_t size = sizes[s];
+
+      for (int i = 0; i < COUNT; ++i) {
+        uint8_t* p = c_aligned_alloc(alignment, size);
+        assert(p != NULL && ((uintptr_t)p & (alignment - 1)) == 0);
+        memset(p, i, size);
+        blocks[i] = p;
+
+        // The padding goes back: heap blocks keep at most a tail too small
+        // to split off, mappings at most the page rounding
+        size_t usable = c_malloc_usable_size(p);
+        assert(usable >= size);
+        if (header((Block*)(p - HEADER)) & MAPPED) {
+          assert(usable < size + PAGE_SIZE);
+        } else {
+          assert(usable < size + ALIGNMENT + MIN_BLOCK);
+        }
+      }
+
+      pthread_mutex_lock(&HEAP_LOCK);
+      heap_check();
+      pthread_mutex_unlock(&HEAP_LOCK);
+
+      for (int i = 0; i < COUNT; ++i) {
+        uint8_t* p = blocks[i];
+        assert(p[0] == (uint8_t)i && p[size - 1] == (uint8_t)i);
+        c_free(p);
+      }
+    }
+  }
+
+  // Aligned mappings keep their offset when realloc moves their pages
+  uint8_t* p = c_aligned_alloc(4096, 2 * MMAP_THRESHOLD);
+  memset(p, 0x5A, 2 * MMAP_THRESHOLD);
+  p = c_realloc(p, 8 * MMAP_THRESHOLD);
+  assert(((uintptr_t)p & (ALIGNMENT - 1)) == 0);
+  assert(p[0] == 0x5A && p[2 * MMAP_THRESHOLD - 1] == 0x5A);
+  c_free(p);
+
+  c_malloc_flush_thread_cache();
+  assert(atomic_load(&HEAP_IN_USE) == heap_before);
+  assert(atomic_load(&LARGE_MAPPED) == mapped_before);
+
+  pthread_mutex_lock(&HEAP_LOCK);
+  heap_check();
+  pthread_mutex_unlock(&HEAP_LOCK);
+
+  printf("Alignment test passed\n");
+}
+
+// Function to grow several buffers side by side through 'resize', the way
+// string builders append, counting how often a buffer had to move
+static void run_appends(void* (*resize)(void*, size_t), void (*release)(void*),
+                        const char* name) {
+  enum { BUILDERS = 4, APPENDS = 50000, PIECE = 24 };
+  uint8_t* buffers[BUILDERS] = {0};
+  size_t moves = 0;
+
+  uint64_t start = now_ns();
+  for (int i = 1; i <= APPENDS; ++i) {
+    for (int k = 0; k < BUILDERS; ++k) {
+      uint8_t* p = resize(buffers[k], (size_t)i * PIECE);
+      if (p != buffers[k] && buffers[k] != NULL) {
+        ++moves;
+      }
+      memset(p + (size_t)(i - 1) * PIECE, k, PIECE);
+      buffers[k] = p;
+    }
+  }
+  double ms = (double)(now_ns() - start) / 1e6;
+
+  for (int k = 0; k < BUILDERS; ++k) {
+    release(buffers[k]);
+  }
+
+  printf("%s: [%.1f ms] moves: [%zu] of [%d] reallocs\n", name, ms, moves,
+         APPENDS * BUILDERS);
+}
+
+// Benchmark of repeated append growth against the C library's realloc
+void benchmark_realloc() {
+  printf("Append growth, 4 interleaved buffers:\n");
+  run_appends(c_realloc, c_free, "c_realloc");
+  run_appends(realloc, free, "realloc  ");
+}
+
+// Function to print a statistics snapshot with its non-empty latency buckets
+static void print_stats(const CMallocStats* st) {
+  printf("allocs: [%llu] frees: [%llu] failed: [%llu] coalesces: [%llu]\n",
+         st->allocs, st->frees, st->failed_allocs, st->coalesces);
+  printf("in use: [%zu] peak: [%zu] heap mapped: [%zu] large mapped: [%zu] "
+         "free blocks: [%zu]\n",
+         st->bytes_in_use, st->peak_bytes_in_use, st->heap_mapped,
+         st->large_mapped, st->free_blocks);
+  printf("heap committed: [%zu] resident: [%zu] decommits: [%llu] "
+         "decommitted: [%zu]\n",
+         st->heap_committed, st->heap_resident, st->decommits,
+         st->decommitted_bytes);
+
+  for (int i = 0; i < C_MALLOC_LATENCY_BUCKETS; ++i) {
+    if (st->malloc_latency[i] != 0 || st->free_latency[i] != 0) {
+      printf("  [%8llu ns, %8llu ns) malloc: [%llu] free: [%llu]\n", 1ull << i,
+             2ull << i, st->malloc_latency[i], st->free_latency[i]);
+    }
+  }
+}
+
+// Test function for the statistics counters and the sampled histograms
+void test_stats() {
+  enum { COUNT = 100, TIMED = 1000 };
+  void* blocks[COUNT];
+  CMallocStats before, after;
+
+  c_malloc_stats(&before);
+  for (int i = 0; i < COUNT; ++i) {
+    blocks[i] = c_malloc((size_t)i * 40);
+  }
+  void* large = c_malloc(1 << 20);
+  c_malloc_stats(&after);
+
+  assert(after.allocs - before.allocs == COUNT + 1);
+  assert(after.bytes_in_use >= before.bytes_in_use + (1 << 20));
+  assert(after.peak_bytes_in_use >= after.bytes_in_use);
+
+  for (int i = 0; i < COUNT; ++i) {
+    c_free(blocks[i]);
+  }
+  c_free(large);
+  c_malloc_stats(&after);
+  assert(after.frees - before.frees == COUNT + 1);
+  assert(after.bytes_in_use < after.peak_bytes_in_use);
+
+  // Time every call for a while
+  c_malloc_sample_latency(1);
+  for (int i = 0; i < TIMED; ++i) {
+    c_free(c_malloc(64));
+  }
+  c_malloc_sample_latency(0);
+
+  unsigned long long timed = 0;
+  c_malloc_stats(&after);
+  for (int i = 0; i < C_MALLOC_LATENCY_BUCKETS; ++i) {
+    timed += after.malloc_latency[i] - before.malloc_latency[i];
+  }
+  assert(timed == TIMED);
+
+  print_stats(&after);
+}
+
+// Function to sleep for a number of milliseconds
+static void sleep_ms(unsigned ms) {
+  struct timespec ts = {ms / 1000, (long)(ms % 1000) * 1000000};
+  nanosleep(&ts, NULL);
+}
+
+// Function to allocate 'count' heap blocks of 'size' bytes and write to all
+// their pages, so they are resident
+static void touch_blocks(uint8_t** blocks, int count, size_t size) {
+  for (int i = 0; i < count; ++i) {
+    blocks[i] = c_malloc(size);
+    assert(blocks[i] != NULL);
+    memset(blocks[i], i, size);
+  }
+}
+
+// Function to check and free blocks written by touch_blocks()
+static void free_blocks(uint8_t** blocks, int count, size_t size) {
+  for (int i = 0; i < count; ++i) {
+    assert(blocks[i][0] == (uint8_t)i && blocks[i][size - 1] == (uint8_t)i);
+    c_free(blocks[i]);
+  }
+}
+
+// Test function for giving free pages back: an explicit trim after a peak,
+// reuse of the decommitted pages, and decay from the free path and from the
+// background thread, watching the resident heap drop each time
+void test_trim() {
+  enum { BLOCKS = 256 };
+  static uint8_t* blocks[BLOCKS];
+  const size_t block = 100 * 1024;  // Heap blocks, below MMAP_THRESHOLD
+  const size_t peak = BLOCKS * block;
+  CMallocStats busy, idle, trimmed;
+
+  touch_blocks(blocks, BLOCKS, block);
+  c_malloc_stats(&busy);
+  free_blocks(blocks, BLOCKS, block);
+  c_malloc_stats(&idle);
+  assert(idle.heap_resident >= peak);
+
+  size_t released = c_malloc_trim(0);
+  c_malloc_stats(&trimmed);
+  assert(released >= peak / 2);
+  assert(trimmed.heap_resident + peak / 2 <= idle.heap_resident);
+  assert(trimmed.heap_committed + released <= idle.heap_committed);
+  assert(c_malloc_trim(0) == 0 && c_malloc_trim(SIZE_MAX) == 0);
+
+  pthread_mutex_lock(&HEAP_LOCK);
+  heap_check();
+  pthread_mutex_unlock(&HEAP_LOCK);
+
+  printf("Trim gave back: [%zu KB] heap resident: [%zu KB] busy, [%zu KB] "
+         "idle, [%zu KB] trimmed\n",
+         released >> 10, busy.heap_resident >> 10, idle.heap_resident >> 10,
+         trimmed.heap_resident >> 10);
+
+  // Decommitted pages work again, and decay finds them once freed
+  c_malloc_set_decay(20, 0);
+  touch_blocks(blocks, BLOCKS, block);
+  free_blocks(blocks, BLOCKS, block);
+  c_malloc_stats(&idle);
+  sleep_ms(50);
+  c_free(c_malloc(2 * PAGE_SIZE));  // Any large free runs the check
+  c_malloc_stats(&trimmed);
+  assert(trimmed.heap_resident + peak / 2 <= idle.heap_resident);
+  printf("Decay on free: heap resident: [%zu KB] -> [%zu KB]\n",
+         idle.heap_resident >> 10, trimmed.heap_resident >> 10);
+
+  // The background thread shrinks the heap without any further call
+  c_malloc_set_decay(20, 1);
+  touch_blocks(blocks, BLOCKS, block);
+  free_blocks(blocks, BLOCKS, block);
+  c_malloc_stats(&idle);
+  sleep_ms(100);
+  c_malloc_stats(&trimmed);
+  assert(trimmed.heap_resident + peak / 2 <= idle.heap_resident);
+  printf("Decay thread: heap resident: [%zu KB] -> [%zu KB]\n",
+         idle.heap_resident >> 10, trimmed.heap_resident >> 10);
+  c_malloc_set_decay(0, 0);
+
+  pthread_mutex_lock(&HEAP_LOCK);
+  heap_check();
+  pthread_mutex_unlock(&HEAP_LOCK);
+}
+
+// Allocation sites for test_heap_profile(); exported, out of line and not
+// ending in a tail call, so they show up by name in the profile
+__attribute__((noinline)) void* profile_site_small() {
+  void* p = c_malloc(64);
+  __asm__ volatile("" : : "r"(p) : "memory");
+  return p;
+}
+
+__attribute__((noinline)) void* profile_site_large() {
+  void* p = c_malloc(1000);
+  __asm__ volatile("" : : "r"(p) : "memory");
+  return p;
+}
+
+// Function to write a collapsed profile to a temporary file and add up the
+// estimated live bytes of the stacks that end in 'site'
+static size_t profiled_bytes(const char* site) {
+  static char text[1 << 20];
+  char path[] = "/tmp/c_malloc_profile_XXXXXX";
+  int fd = mkstemp(path);
+  assert(fd >= 0);
+  unlink(path);
+
+  assert(c_malloc_profile_write(fd, C_MALLOC_PROFILE_COLLAPSED) == 0);
+  ssize_t length = pread(fd, text, sizeof(text) - 1, 0);
+  close(fd);
+  assert(length >= 0);
+  text[length] = '\0';
+
+  size_t bytes = 0;
+  char* save = NULL;
+  for (char* line = strtok_r(text, "\n", &save); line != NULL;
+       line = strtok_r(NULL, "\n", &save)) {
+    // Stacks run outermost first; allocator frames must not follow the site
+    char* count = strrchr(line, ' ');
+    char* leaf = memrchr(line, ';', (size_t)(count - line));
+    leaf = leaf != NULL ? leaf + 1 : line;
+    if ((size_t)(count - leaf) == strlen(site) &&
+        strncmp(leaf, site, strlen(site)) == 0) {
+      bytes += strtoull(count + 1, NULL, 10);
+    }
+  }
+  return bytes;
+}
+
+// Function to time 'rounds' malloc/free pairs in nanoseconds per pair
+static double time_pairs(int rounds) {
+  uint64_t start = now_ns();
+  for (int i = 0; i < rounds; ++i) {
+    void* p = c_malloc(16 + (size_t)(i % 8) * 16);
+    __asm__ volatile("" : : "r"(p) : "memory");
+    c_free(p);
+  }
+  return (double)(now_ns() - start) / rounds;
+}
+
+// Test function for the sampling heap profiler: the estimated live bytes of
+// two call sites track what they really hold, freed blocks leave the
+// profile, both output formats are written, a signal asks for a dump, and
+// sampling costs little when it is off
+void test_heap_profile() {
+  enum { SMALL = 20000, LARGE = 2000, ROUNDS = 2000000 };
+  static void* small[SMALL];
+  static void* large[LARGE];
+  const size_t small_bytes = SMALL * 64;
+  const size_t large_bytes = LARGE * 1000;
+
+  double off = time_pairs(ROUNDS);
+  assert(c_malloc_profile_start(4096) == 0);
+
+  for (int i = 0; i < SMALL; ++i) {
+    small[i] = profile_site_small();
+  }
+  for (int i = 0; i < LARGE; ++i) {
+    large[i] = profile_site_large();
+  }
+
+  // About 300 and 500 samples; a quarter off would be five deviations
+  size_t small_estimate = profiled_bytes("profile_site_small");
+  size_t large_estimate = profiled_bytes("profile_site_large");
+  assert(small_estimate > small_bytes * 3 / 4 &&
+         small_estimate < small_bytes * 5 / 4);
+  assert(large_estimate > large_bytes * 3 / 4 &&
+         large_estimate < large_bytes * 5 / 4);
+
+  for (int i = 0; i < SMALL; ++i) {
+    c_free(small[i]);
+  }
+  assert(profiled_bytes("profile_site_small") == 0);
+  assert(profiled_bytes("profile_site_large") == large_estimate);
+
+  // The pprof format keeps the raw samples and the mappings
+  char path[] = "/tmp/c_malloc_profile_XXXXXX";
+  int fd = mkstemp(path);
+  assert(fd >= 0 && c_malloc_profile_write(fd, C_MALLOC_PROFILE_PPROF) == 0);
+  char head[64] = {0};
+  assert(pread(fd, head, sizeof(head) - 1, 0) > 0);
+  assert(strncmp(head, "heap profile: ", 14) == 0);
+  close(fd);
+
+  // A signal only asks; the next allocation writes the profile
+  assert(c_malloc_profile_on_signal(SIGUSR2, path,
+                                    C_MALLOC_PROFILE_PPROF) == 0);
+  raise(SIGUSR2);
+  c_free(c_malloc(16));
+  char dumped[sizeof(path) + 16];
+  snprintf(dumped, sizeof(dumped), "%s.1.heap", path);
+  assert(access(dumped, R_OK) == 0);
+  unlink(dumped);
+  unlink(path);
+  signal(SIGUSR2, SIG_DFL);
+
+  double on = time_pairs(ROUNDS);
+  for (int i = 0; i < LARGE; ++i) {
+    c_free(large[i]);
+  }
+  assert(c_malloc_profile_start(0) == 0);
+  double stopped = time_pairs(ROUNDS);
+
+  // Large blocks sampled before the profiler stopped keep their bit, which
+  // must not leak into the length of their mappings
+  const size_t mib = 1 << 20;
+  size_t usable = c_malloc_usable_size(large[0] = c_malloc(mib));
+  c_free(large[0]);
+  assert(c_malloc_profile_start(1) == 0);
+  uint8_t* first = c_malloc(mib);
+  uint8_t* second = c_malloc(mib);
+  assert(header((Block*)(first - HEADER)) & SAMPLED);
+  assert(c_malloc_usable_size(first) == usable);
+  assert(c_malloc_profile_start(0) == 0);
+  c_free(second);
+  memset(first, 0xAB, mib);  // Its mapping is still there
+  c_free(first);
+
+  printf("Heap profile estimates: [%zu] of [%zu] and [%zu] of [%zu] bytes\n",
+         small_estimate, small_bytes, large_estimate, large_bytes);
+  printf("malloc/free pair: [%.1f ns] off, [%.1f ns] sampling every 4 KB, "
+         "[%.1f ns] stopped\n",
+         off, on, stopped);
+}
+
+// Function to check that the numbers of a heap walk add up
+static void check_heap_info(const CMallocHeapInfo* info) {
+  size_t blocks = 0;
+  size_t bytes = 0;
+  for (int i = 0; i < C_MALLOC_HISTOGRAM_BUCKETS; ++i) {
+    blocks += info->free_histogram[i];
+  }
+  for (int i = 0; i < C_MALLOC_SIZE_CLASSES; ++i) {
+    bytes += info->classes[i].free_bytes;
+  }
+  assert(blocks == info->free_blocks && bytes == info->free_bytes);
+  assert(info->used_bytes + info->free_bytes <= info->heap_mapped);
+  assert(info->largest_free_block <= info->free_bytes);
+  assert(info->released_bytes <= info->free_bytes);
+  assert(info->fragmentation >= 0.0 && info->fragmentation < 1.0);
+}
+
+// Test function for the heap map: size classes map back to their bins,
+// holes punched between live blocks show up as free blocks of their class
+// and raise the fragmentation, and the JSON map has one character per page
+void test_heap_map() {
+  enum { BLOCKS = 1024 };
+  static uint8_t* blocks[BLOCKS];
+  static char json[4 << 20];
+  const size_t size = 1000;
+  const int size_class = bin_index(size + HEADER);
+
+  for (int i = 0; i < C_MALLOC_SIZE_CLASSES - 1; ++i) {
+    assert(bin_index(heap_class_size(i)) == i);
+    assert(bin_index(heap_class_size(i + 1) - ALIGNMENT) == i);
+  }
+
+  CMallocHeapInfo before, packed, holes;
+  c_malloc_heap_info(&before);
+  check_heap_info(&before);
+
+  for (int i = 0; i < BLOCKS; ++i) {
+    blocks[i] = c_malloc(size);
+  }
+  c_malloc_heap_info(&packed);
+  check_heap_info(&packed);
+  assert(packed.classes[size_class].used_blocks ==
+         before.classes[size_class].used_blocks + BLOCKS);
+
+  // Every other block, so that no hole can merge with a neighbor
+  for (int i = 1; i < BLOCKS - 1; i += 2) {
+    c_free(blocks[i]);
+    blocks[i] = NULL;
+  }
+  c_malloc_heap_info(&holes);
+  check_heap_info(&holes);
+  assert(holes.classes[size_class].free_blocks >=
+         packed.classes[size_class].free_blocks + BLOCKS / 4);
+  assert(holes.fragmentation > packed.fragmentation);
+
+  char path[] = "/tmp/c_malloc_heap_map_XXXXXX";
+  int fd = mkstemp(path);
+  assert(fd >= 0);
+  unlink(path);
+  assert(c_malloc_heap_map_write(fd) == 0);
+  ssize_t length = pread(fd, json, sizeof(json) - 1, 0);
+  close(fd);
+  assert(length > 0 && (size_t)length < sizeof(json) - 1);
+  json[length] = '\0';
+  const char head[] = "{\n  \"page_size\": 4096,";
+  assert(strncmp(json, head, sizeof(head) - 1) == 0);
+  assert(strstr(json, "\"fragmentation\": ") != NULL);
+
+  size_t chunks = 0;
+  for (char* chunk = strstr(json, "\"size\": "); chunk != NULL;
+       chunk = strstr(chunk + 1, "\"size\": ")) {
+    size_t chunk_size = strtoull(chunk + 8, NULL, 10);
+    char* pages = strstr(chunk, "\"pages\": \"") + 10;
+    assert(strspn(pages, "#123456789.-") == chunk_size / MAP_PAGE);
+    assert(pages[chunk_size / MAP_PAGE] == '"');
+    ++chunks;
+  }
+  assert(chunks >= holes.chunks);
+
+  for (int i = 0; i < BLOCKS; ++i) {
+    c_free(blocks[i]);
+  }
+  CMallocHeapInfo after;
+  c_malloc_heap_info(&after);
+  check_heap_info(&after);
+
+  printf("Heap map: [%zu] chunks, [%zd] bytes of JSON, fragmentation: "
+         "[%.3f] packed, [%.3f] with holes, [%.3f] freed\n",
+         holes.chunks, length, packed.fragmentation, holes.fragmentation,
+         after.fragmentation);
+}
+
+// Blocks handed between threads in test_threads(), so that memory allocated
+// on one thread is freed on another
+#define SHARED_SLOTS 64
+static _Atomic(uintptr_t) SHARED[SHARED_SLOTS];
+
+// Function to fill a block with a pattern derived from its size and owner
+static void fill_block(uint8_t* p, size_t size, uint8_t tag) {
+  memcpy(p, &size, sizeof(size));
+  memset(p + sizeof(size), tag, size - sizeof(size));
+}
+
+// Function to verify and release a block written by fill_block()
+static void check_and_free(uint8_t* p) {
+  size_t size;
+  memcpy(&size, p, sizeof(size));
+  for (size_t i = sizeof(size) + 1; i < size; ++i) {
+    assert(p[i] == p[sizeof(size)]);
+  }
+  c_free(p);
+}
+
+static void* thread_churn(void* arg) {
+  enum { LIVE = 64, OPS = 20000 };
+  uint8_t* live[LIVE] = {0};
+  uint32_t seed = (uint32_t)(uintptr_t)arg * 2654435761u + 1;
+
+  for (int op = 0; op < OPS; ++op) {
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+
+    int slot = seed % LIVE;
+    if (live[slot] == NULL) {
+      size_t size = sizeof(size_t) + 1 + (seed >> 8) % 600;
+      live[slot] = c_malloc(size);
+      assert(live[slot] != NULL);
+      fill_block(live[slot], size, (uint8_t)seed);
+    } else if (seed & 0x10000) {
+      // Hand the block to whichever thread picks this slot up next
+      uintptr_t old = atomic_exchange(&SHARED[(seed >> 8) % SHARED_SLOTS],
+                                      (uintptr_t)live[slot]);
+      if (old != 0) {
+        check_and_free((uint8_t*)old);
+      }
+      live[slot] = NULL;
+    } else {
+      check_and_free(live[slot]);
+      live[slot] = NULL;
+    }
+  }
+
+  for (int i = 0; i < LIVE; ++i) {
+    if (live[i] != NULL) {
+      check_and_free(live[i]);
+    }
+  }
+  return NULL;
+}
+
+// Test function hammering the allocator from several threads at once: every
+// block is pattern-filled and checked before it is freed, a share of them is
+// freed by a different thread, and afterwards the heap must be whole again
+void test_threads() {
+  enum { THREADS = 4 };
+  pthread_t threads[THREADS];
+
+  for (int i = 0; i < THREADS; ++i) {
+    pthread_create(&threads[i], NULL, thread_churn, (void*)(uintptr_t)(i + 1));
+  }
+  for (int i = 0; i < THREADS; ++i) {
+    pthread_join(threads[i], NULL);
+  }
+  for (int i = 0; i < SHARED_SLOTS; ++i) {
+    uintptr_t p = atomic_exchange(&SHARED[i], 0);
+    if (p != 0) {
+      check_and_free((uint8_t*)p);
+    }
+  }
+  c_malloc_flush_thread_cache();
+
+  // Every block was returned, so each chunk must have coalesced back
+  pthread_mutex_lock(&HEAP_LOCK);
+  size_t free_bytes = 0;
+  for (int i = 0; i < BIN_COUNT; ++i) {
+    for (Block* b = BINS[i]; b != NULL; b = b->next) {
+      free_bytes += size_of(b);
+    }
+  }
+  assert(free_bytes == HEAP_MAPPED - CHUNK_COUNT * (CHUNK_HEADER + HEADER));
+  assert(IN_USE == CHUNK_COUNT);
+  pthread_mutex_unlock(&HEAP_LOCK);
+
+  printf("Multi-threaded test passed with [%d] threads\n", THREADS);
+}
+
+static void* thread_pairs(void* arg) {
+  enum { LIVE = 16 };
+  long rounds = (long)(intptr_t)arg;
+  void* live[LIVE] = {0};
+
+  for (long i = 0; i < rounds; ++i) {
+    int slot = (int)(i % LIVE);
+    c_free(live[slot]);
+    live[slot] = c_malloc(16 + (size_t)(i % 8) * 16);
+  }
+  for (int i = 0; i < LIVE; ++i) {
+    c_free(live[i]);
+  }
+  return NULL;
+}
+
+// Benchmark measuring how malloc/free throughput scales with thread count
+void benchmark_threads() {
+  enum { MAX_THREADS = 8, ROUNDS = 1000000 };
+  pthread_t threads[MAX_THREADS];
+
+  printf("Small malloc/free throughput by thread count:\n");
+
+  for (int count = 1; count <= MAX_THREADS; count *= 2) {
+    uint64_t start = now_ns();
+    for (int i = 0; i < count; ++i) {
+      pthread_create(&threads[i], NULL, thread_pairs,
+                     (void*)(intptr_t)ROUNDS);
+    }
+    for (int i = 0; i < count; ++i) {
+      pthread_join(threads[i], NULL);
+    }
+    double seconds = (double)(now_ns() - start) / 1e9;
+
+    printf("Threads: [%d] throughput: [%.1f Mops/s]\n", count,
+           2.0 * ROUNDS * count / seconds / 1e6);
+  }
+}
+
+int main(void) {
   test();  // Run the memory management test
+  test_large();
+  test_heap_invariants();
+  test_realloc();
+  test_alignment();
+  test_threads();
+  test_stats();
+  test_trim();
+  test_heap_profile();
+  test_heap_map();
+  benchmark_bins();
+  benchmark_threads();
+  benchmark_realloc();
   return 0;
 }
+
+#endif  // C_MALLOC_LIBRARY
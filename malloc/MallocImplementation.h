@@ -0,0 +1,150 @@
+#ifndef MALLOC_IMPLEMENTATION_H
+#define MALLOC_IMPLEMENTATION_H
+
+#include <stddef.h>
+
+// Public interface of the c_malloc heap. Everything else in
+// MallocImplementation.c is internal; shared builds hide it.
+#define C_MALLOC_API __attribute__((visibility("default")))
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define C_MALLOC_LATENCY_BUCKETS 32
+#define C_MALLOC_HISTOGRAM_BUCKETS 32  // Power-of-two free block sizes
+#define C_MALLOC_SIZE_CLASSES 64       // Free lists of the central heap
+
+// Snapshot of the allocator statistics. Blocks held in thread caches count as
+// in use, since the heap has handed them out.
+typedef struct {
+  unsigned long long allocs;         // Successful allocations
+  unsigned long long frees;          // Frees of non-NULL pointers
+  unsigned long long failed_allocs;  // Allocations that returned NULL
+  unsigned long long coalesces;      // Merges of neighboring free blocks
+  size_t bytes_in_use;               // Heap blocks and mappings handed out
+  size_t peak_bytes_in_use;          // High-water mark of bytes_in_use
+  size_t heap_mapped;                // Bytes mapped for heap chunks
+  size_t heap_committed;             // heap_mapped less decommitted pages
+  size_t heap_resident;              // Heap chunk bytes resident in memory
+  size_t large_mapped;               // Bytes in dedicated mappings
+  size_t free_blocks;                // Blocks on the central free lists
+  unsigned long long decommits;      // Free ranges given back to the OS
+  size_t decommitted_bytes;          // Bytes given back so far
+
+  // Sampled latencies; bucket i counts calls of [2^i, 2^(i+1)) nanoseconds
+  unsigned long long malloc_latency[C_MALLOC_LATENCY_BUCKETS];
+  unsigned long long free_latency[C_MALLOC_LATENCY_BUCKETS];
+} CMallocStats;
+
+// Define a structure for the blocks of one size class of the central heap
+typedef struct {
+  size_t min_size;     // Smallest block size of the class, header included
+  size_t used_blocks;  // Allocated blocks, thread caches included
+  size_t used_bytes;
+  size_t free_blocks;  // Blocks on the free list of the class
+  size_t free_bytes;
+} CMallocSizeClass;
+
+// Layout of the central heap, from a walk over all of its blocks. Blocks in
+// their own mappings are left out; CMallocStats counts them.
+typedef struct {
+  size_t chunks;              // Heap chunks mapped from the OS
+  size_t heap_mapped;         // Their bytes
+  size_t used_bytes;          // Bytes of allocated blocks, headers included
+  size_t free_bytes;          // Bytes of free blocks
+  size_t free_blocks;
+  size_t largest_free_block;
+  size_t released_bytes;      // Free pages given back to the OS
+
+  // External fragmentation: the share of free bytes outside the largest free
+  // block, 0 when all free memory could serve a single request
+  double fragmentation;
+
+  // Free blocks of [2^i, 2^(i+1)) bytes
+  size_t free_histogram[C_MALLOC_HISTOGRAM_BUCKETS];
+  CMallocSizeClass classes[C_MALLOC_SIZE_CLASSES];
+} CMallocHeapInfo;
+
+// Function to allocate memory of a given size
+C_MALLOC_API void* c_malloc(size_t size);
+
+// Function to free previously allocated memory
+C_MALLOC_API void c_free(void* ptr);
+
+// Function to change the size of an allocation, in place whenever possible
+C_MALLOC_API void* c_realloc(void* ptr, size_t size);
+
+// Function to allocate zeroed memory for an array
+C_MALLOC_API void* c_calloc(size_t count, size_t size);
+
+// Function to allocate memory aligned to a power of two. Plain c_malloc()
+// pointers are already 16-byte aligned.
+C_MALLOC_API void* c_aligned_alloc(size_t alignment, size_t size);
+
+// Function to report how many bytes can be used through a pointer
+C_MALLOC_API size_t c_malloc_usable_size(void* ptr);
+
+// Function to return the calling thread's cached blocks to the central heap
+C_MALLOC_API void c_malloc_flush_thread_cache(void);
+
+// Function to take a snapshot of the allocator statistics
+C_MALLOC_API void c_malloc_stats(CMallocStats* stats);
+
+// Function to time every n-th c_malloc/c_free call of each thread, or none
+// when 'every' is 0. Timing costs two clock reads per sampled call.
+C_MALLOC_API void c_malloc_sample_latency(unsigned every);
+
+// Function to give whole free pages of the heap back to the OS with
+// madvise(), keeping up to 'pad' bytes of them committed. Returns the number
+// of bytes given back. The pages come back zeroed when they are reused.
+C_MALLOC_API size_t c_malloc_trim(size_t pad);
+
+// Function to give free heap pages back once they have been free for
+// 'decay_ms' milliseconds, or never when it is 0. The check runs whenever a
+// block of a page or more is freed; with 'background' set, a thread also runs
+// it every decay_ms / 2 so that idle processes shrink too.
+C_MALLOC_API void c_malloc_set_decay(unsigned decay_ms, int background);
+
+// Heap profile formats
+#define C_MALLOC_PROFILE_PPROF 0      // Legacy heap profile read by pprof
+#define C_MALLOC_PROFILE_COLLAPSED 1  // Folded stacks for flame graphs
+
+// Function to sample about one allocation per 'sample_bytes' allocated
+// bytes, at random geometric intervals, and keep the stack of each sampled
+// block until it is freed. Starting again drops the samples so far; 0 stops
+// the profiler. Returns 0 on success.
+C_MALLOC_API int c_malloc_profile_start(size_t sample_bytes);
+
+// Function to write the profile of the sampled live heap to a file
+// descriptor. The collapsed format estimates the live bytes of each stack;
+// the pprof format holds the raw samples and leaves the scaling to pprof.
+// Returns 0 on success.
+C_MALLOC_API int c_malloc_profile_write(int fd, int format);
+
+// Function to write the profile of the sampled live heap to a file
+C_MALLOC_API int c_malloc_profile_dump(const char* path, int format);
+
+// Function to write a profile to '<path>.<n>.heap', or '<path>.<n>.folded'
+// in the collapsed format, each time signal 'signo' arrives. The handler only
+// raises a flag; the next sampled thread's allocation writes the profile.
+C_MALLOC_API int c_malloc_profile_on_signal(int signo, const char* path,
+                                            int format);
+
+// Function to walk the central heap and describe its fragmentation. The heap
+// stays locked during the walk, which visits every block.
+C_MALLOC_API void c_malloc_heap_info(CMallocHeapInfo* info);
+
+// Function to write the layout of the central heap as JSON to a file
+// descriptor: the CMallocHeapInfo numbers, plus one character per page of
+// every chunk telling how much of it is allocated. Returns 0 on success.
+C_MALLOC_API int c_malloc_heap_map_write(int fd);
+
+// Function to write the layout of the central heap as JSON to a file
+C_MALLOC_API int c_malloc_heap_map_dump(const char* path);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // MALLOC_IMPLEMENTATION_H
@@ -0,0 +1,136 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "HeapProfile.h"
+#include "MallocImplementation.h"
+
+// Drop-in replacement for the C library allocator, built as a shared library
+// and loaded with LD_PRELOAD. Every entry point forwards to the c_malloc heap,
+// which gets its memory from mmap and never calls back into libc's malloc, so
+// there is nothing to look up with dlsym and no startup recursion to break.
+//
+// CMALLOC_DECAY_MS=<ms> gives free heap pages back to the OS once they have
+// been idle that long, with a background thread covering idle periods.
+// CMALLOC_PROFILE_BYTES=<n> samples about one allocation per n bytes for the
+// heap profile, and kill -USR2 writes it to <CMALLOC_PROFILE>.<k>.heap, or
+// to .folded stacks when CMALLOC_PROFILE_FORMAT=collapsed.
+// CMALLOC_HEAP_MAP=<path> writes the heap map there as the process exits.
+
+// Function to apply the environment settings when the library is loaded
+__attribute__((constructor)) static void read_settings() {
+  const char* decay = getenv("CMALLOC_DECAY_MS");
+  if (decay != NULL && *decay != '\0') {
+    c_malloc_set_decay((unsigned)strtoul(decay, NULL, 10), 1);
+  }
+
+  const char* sample = getenv("CMALLOC_PROFILE_BYTES");
+  if (sample != NULL && *sample != '\0' &&
+      c_malloc_profile_start(strtoull(sample, NULL, 10)) == 0) {
+    const char* prefix = getenv("CMALLOC_PROFILE");
+    const char* format = getenv("CMALLOC_PROFILE_FORMAT");
+    c_malloc_profile_on_signal(
+        SIGUSR2, prefix != NULL && *prefix != '\0' ? prefix : "cmalloc",
+        format != NULL && strcmp(format, "collapsed") == 0
+            ? C_MALLOC_PROFILE_COLLAPSED
+            : C_MALLOC_PROFILE_PPROF);
+  }
+}
+
+// Function to write the heap map the environment asked for at exit
+__attribute__((destructor)) static void write_heap_map() {
+  const char* path = getenv("CMALLOC_HEAP_MAP");
+  if (path != NULL && *path != '\0') {
+    c_malloc_heap_map_dump(path);
+  }
+}
+
+// Function to check an alignment argument of the memalign family
+static int valid_alignment(size_t alignment) {
+  return alignment != 0 && (alignment & (alignment - 1)) == 0;
+}
+
+C_MALLOC_API PROFILE_ENTRY void* malloc(size_t size) {
+  void* p = c_malloc(size);
+  if (p == NULL) {
+    errno = ENOMEM;
+  }
+  return p;
+}
+
+C_MALLOC_API void free(void* ptr) { c_free(ptr); }
+
+C_MALLOC_API PROFILE_ENTRY void* calloc(size_t count, size_t size) {
+  void* p = c_calloc(count, size);
+  if (p == NULL) {
+    errno = ENOMEM;
+  }
+  return p;
+}
+
+C_MALLOC_API PROFILE_ENTRY void* realloc(void* ptr, size_t size) {
+  void* p = c_realloc(ptr, size);
+  if (p == NULL && size != 0) {
+    errno = ENOMEM;
+  }
+  return p;
+}
+
+C_MALLOC_API PROFILE_ENTRY void* reallocarray(void* ptr, size_t count,
+                                             size_t size) {
+  size_t total;
+  if (__builtin_mul_overflow(count, size, &total)) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  return realloc(ptr, total);
+}
+
+C_MALLOC_API PROFILE_ENTRY int posix_memalign(void** out, size_t alignment,
+                                              size_t size) {
+  if (!valid_alignment(alignment) || alignment % sizeof(void*) != 0) {
+    return EINVAL;
+  }
+
+  void* p = c_aligned_alloc(alignment, size);
+  if (p == NULL) {
+    return ENOMEM;
+  }
+  *out = p;
+  return 0;
+}
+
+C_MALLOC_API PROFILE_ENTRY void* aligned_alloc(size_t alignment, size_t size) {
+  if (!valid_alignment(alignment)) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  void* p = c_aligned_alloc(alignment, size);
+  if (p == NULL) {
+    errno = ENOMEM;
+  }
+  return p;
+}
+
+C_MALLOC_API PROFILE_ENTRY void* memalign(size_t alignment, size_t size) {
+  return aligned_alloc(alignment, size);
+}
+
+C_MALLOC_API PROFILE_ENTRY void* valloc(size_t size) {
+  return aligned_alloc(4096, size);
+}
+
+C_MALLOC_API PROFILE_ENTRY void* pvalloc(size_t size) {
+  return aligned_alloc(4096, (size + 4095) & ~(size_t)4095);
+}
+
+C_MALLOC_API size_t malloc_usable_size(void* ptr) {
+  return c_malloc_usable_size(ptr);
+}
+
+C_MALLOC_API int malloc_trim(size_t pad) { return c_malloc_trim(pad) != 0; }
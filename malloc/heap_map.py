@@ -0,0 +1,122 @@
+#!/usr/bin/env python3
+"""Render a c_malloc heap map as a PNG image and print its numbers.
+
+    heap_map.py map.json [map.png] [--width PAGES] [--scale PIXELS]
+
+The map comes from c_malloc_heap_map_dump(), or from a program run with
+CMALLOC_HEAP_MAP=<path> LD_PRELOAD=libcmalloc.so. Every page of the heap is
+one square: dark for allocated, shades for partly allocated, light for free
+and white for free pages given back to the OS. Chunks are drawn in address
+order, each starting on a new row, with a gap row between them. Only the
+standard library is needed.
+"""
+
+import argparse
+import json
+import struct
+import sys
+import zlib
+
+# Page characters of the map and their colors
+COLORS = {
+    "#": (33, 47, 92),
+    "-": (255, 255, 255),
+    ".": (214, 228, 240),
+}
+FREE = COLORS["."]
+USED = COLORS["#"]
+GAP = (128, 128, 128)
+
+
+def page_color(c):
+    """Returns the color of one page character; digits blend free into used."""
+    if c in COLORS:
+        return COLORS[c]
+    t = int(c) / 9.0
+    return tuple(round(f + (u - f) * t) for f, u in zip(FREE, USED))
+
+
+def png_chunk(kind, data):
+    body = kind + data
+    return (struct.pack(">I", len(data)) + body +
+            struct.pack(">I", zlib.crc32(body) & 0xFFFFFFFF))
+
+
+def write_png(path, rows, scale):
+    """Writes rows of RGB tuples, each pixel as a scale x scale square."""
+    width = max(len(row) for row in rows) * scale
+    raw = bytearray()
+    for row in rows:
+        line = bytearray([0])  # Filter type: none
+        for pixel in row:
+            line += bytes(pixel) * scale
+        line += bytes(GAP) * (width - (len(line) - 1) // 3)
+        raw += line * scale
+
+    with open(path, "wb") as out:
+        out.write(b"\x89PNG\r\n\x1a\n")
+        out.write(png_chunk(b"IHDR", struct.pack(
+            ">IIBBBBB", width, len(rows) * scale, 8, 2, 0, 0, 0)))
+        out.write(png_chunk(b"IDAT", zlib.compress(bytes(raw), 9)))
+        out.write(png_chunk(b"IEND", b""))
+
+
+def map_rows(heap, width):
+    rows = []
+    for chunk in sorted(heap["chunks"], key=lambda c: int(c["address"], 16)):
+        if rows:
+            rows.append([GAP] * width)
+        pages = chunk["pages"]
+        for start in range(0, len(pages), width):
+            rows.append([page_color(c) for c in pages[start:start + width]])
+    return rows
+
+
+def print_summary(heap):
+    mib = 1 << 20
+    print("Heap mapped: [%.1f MiB] in [%d] chunks" %
+          (heap["heap_mapped"] / mib, len(heap["chunks"])))
+    print("Used: [%.1f MiB] free: [%.1f MiB] in [%d] blocks, released: "
+          "[%.1f MiB]" % (heap["used_bytes"] / mib, heap["free_bytes"] / mib,
+                          heap["free_blocks"], heap["released_bytes"] / mib))
+    print("Largest free block: [%d] fragmentation: [%.3f]" %
+          (heap["largest_free_block"], heap["fragmentation"]))
+
+    print("Free block sizes:")
+    for bucket in heap["free_histogram"]:
+        print("  [%10d, %10d) blocks: [%d]" %
+              (bucket["min_size"], 2 * bucket["min_size"], bucket["blocks"]))
+
+    print("Size classes:")
+    for c in heap["size_classes"]:
+        blocks = c["used_blocks"] + c["free_blocks"]
+        print("  class [%2d] from [%9d] used: [%7d] free: [%7d] "
+              "occupancy: [%5.1f%%]" %
+              (c["class"], c["min_size"], c["used_blocks"], c["free_blocks"],
+               100.0 * c["used_blocks"] / blocks))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("map", help="JSON heap map")
+    parser.add_argument("image", nargs="?", help="PNG to write")
+    parser.add_argument("--width", type=int, default=256,
+                        help="pages per row (default 256, one MiB)")
+    parser.add_argument("--scale", type=int, default=3,
+                        help="pixels per page side (default 3)")
+    args = parser.parse_args()
+
+    with open(args.map) as f:
+        heap = json.load(f)
+
+    print_summary(heap)
+    if args.image:
+        rows = map_rows(heap, max(1, args.width))
+        if not rows:
+            sys.exit("The heap has no chunks")
+        write_png(args.image, rows, max(1, args.scale))
+        print("Image: [%s]" % args.image)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,278 @@
+#ifndef CONCURRENT_POOL_ALLOCATOR_H
+#define CONCURRENT_POOL_ALLOCATOR_H
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// Process-wide pool of fixed-size slots that any thread can allocate from and
+// free to, whichever thread allocated the slot.
+//
+// Each thread keeps two magazines, short lists of free slots. Allocating pops
+// a slot off the loaded magazine and freeing pushes one, with no atomic
+// read-modify-write. Only when both magazines are empty or both are full
+// does a thread trade a whole magazine with the depot. The depot is a
+// lock-free stack of full magazines: a Treiber stack whose top carries a
+// 16-bit tag next to a 48-bit pointer. Every push and pop bumps the tag, so a
+// magazine that was popped and pushed back in between fails the CAS instead
+// of corrupting the stack (ABA). New slots are carved out of slabs under a
+// mutex, once per magazine.
+//
+// Slabs are never unmapped. A thread that lost a race may still read a
+// magazine's link after another thread took it, and that memory has to stay
+// valid. The pool and its slabs therefore live until the process exits, and
+// memory comes back through reuse only.
+template <size_t SlotSize>
+class ConcurrentSlotPool {
+  static_assert(SlotSize % alignof(std::max_align_t) == 0,
+                "Slots must keep max_align_t alignment");
+  static_assert(sizeof(void*) == 8, "Tagged pointers need a 64-bit target");
+
+ public:
+  static constexpr size_t MAGAZINE_SLOTS = 64;
+
+  // Function to get the single pool for this slot size
+  static ConcurrentSlotPool& instance() {
+    static ConcurrentSlotPool* pool = new ConcurrentSlotPool;  // Never freed
+    return *pool;
+  }
+
+  void* allocate() {
+    ThreadCache& cache = thread_cache();
+    Magazine& loaded = cache.loaded;
+
+    if (loaded.count == 0) {
+      if (cache.previous.count != 0) {
+        std::swap(loaded, cache.previous);
+      } else if (!depot_pop(loaded)) {
+        carve(loaded);
+      }
+    }
+    Slot* slot = loaded.head;
+    loaded.head = slot->next;
+    --loaded.count;
+    return slot;
+  }
+
+  void deallocate(void* p) noexcept {
+    ThreadCache& cache = thread_cache();
+    Magazine& loaded = cache.loaded;
+
+    if (loaded.count == MAGAZINE_SLOTS) {
+      if (cache.previous.count != 0) {
+        depot_push(cache.previous);
+      }
+      cache.previous = loaded;
+      loaded = Magazine();
+    }
+    Slot* slot = static_cast<Slot*>(p);
+    slot->next = loaded.head;
+    loaded.head = slot;
+    ++loaded.count;
+  }
+
+  // Bytes taken from the system for slabs
+  size_t slab_bytes() const noexcept {
+    return slab_bytes_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  static constexpr size_t SLAB_SLOTS = 16 * MAGAZINE_SLOTS;
+  static constexpr uint64_t POINTER_BITS = 48;
+  static constexpr uint64_t POINTER_MASK = (uint64_t{1} << POINTER_BITS) - 1;
+
+  // Define a structure for a free slot. The first slot of a magazine in the
+  // depot also links to the next magazine down the stack.
+  struct Slot {
+    Slot* next;
+    Slot* next_magazine;
+  };
+  static_assert(SlotSize >= sizeof(Slot), "Slots must fit two links");
+
+  // Define a structure for a list of free slots owned by one thread
+  struct Magazine {
+    Slot* head = nullptr;
+    size_t count = 0;
+  };
+
+  // Define a structure for the magazines of one thread. They go to the depot
+  // when the thread exits, so its free slots are not lost.
+  struct ThreadCache {
+    Magazine loaded;
+    Magazine previous;
+
+    ~ThreadCache() {
+      ConcurrentSlotPool& pool = instance();
+      if (loaded.count != 0) {
+        pool.depot_push(loaded);
+      }
+      if (previous.count != 0) {
+        pool.depot_push(previous);
+      }
+    }
+  };
+
+  ConcurrentSlotPool() = default;
+
+  static ThreadCache& thread_cache() {
+    static thread_local ThreadCache cache;
+    return cache;
+  }
+
+  static uint64_t pack(Slot* slot, uint64_t tag) noexcept {
+    uint64_t bits = reinterpret_cast<uintptr_t>(slot);
+    assert((bits & ~POINTER_MASK) == 0);
+    return (tag << POINTER_BITS) | bits;
+  }
+
+  static Slot* unpack(uint64_t top) noexcept {
+    return reinterpret_cast<Slot*>(static_cast<uintptr_t>(top & POINTER_MASK));
+  }
+
+  // Function to push a magazine onto the depot stack and leave it empty.
+  // Depot magazines may be partly filled by exiting threads; the count is
+  // taken again when one is popped.
+  void depot_push(Magazine& magazine) noexcept {
+    Slot* head = magazine.head;
+    uint64_t top = depot_.load(std::memory_order_relaxed);
+    do {
+      __atomic_store_n(&head->next_magazine, unpack(top), __ATOMIC_RELAXED);
+    } while (!depot_.compare_exchange_weak(
+        top, pack(head, (top >> POINTER_BITS) + 1), std::memory_order_release,
+        std::memory_order_relaxed));
+    magazine = Magazine();
+  }
+
+  // Function to pop a magazine off the depot stack into 'magazine', which
+  // must be empty. Returns false when the depot is empty.
+  bool depot_pop(Magazine& magazine) noexcept {
+    uint64_t top = depot_.load(std::memory_order_acquire);
+    Slot* head;
+    do {
+      head = unpack(top);
+      if (head == nullptr) {
+        return false;
+      }
+      // 'head' may be taken and reused by now; slabs stay mapped and the
+      // tag makes the CAS fail, so the stale link is never installed
+    } while (!depot_.compare_exchange_weak(
+        top,
+        pack(__atomic_load_n(&head->next_magazine, __ATOMIC_RELAXED),
+             (top >> POINTER_BITS) + 1),
+        std::memory_order_acquire, std::memory_order_acquire));
+
+    magazine.head = head;
+    magazine.count = 0;
+    for (Slot* slot = head; slot != nullptr; slot = slot->next) {
+      ++magazine.count;
+    }
+    return true;
+  }
+
+  // Function to fill an empty magazine with fresh slots from the slabs
+  void carve(Magazine& magazine) {
+    std::lock_guard<std::mutex> lock(carve_lock_);
+
+    if (slab_ == end_) {
+      size_t bytes = SLAB_SLOTS * SlotSize;
+      slab_ = static_cast<char*>(::operator new(bytes));
+      end_ = slab_ + bytes;
+      slab_bytes_.fetch_add(bytes, std::memory_order_relaxed);
+    }
+
+    Slot* head = nullptr;
+    for (size_t i = 0; i < MAGAZINE_SLOTS; ++i) {
+      end_ -= SlotSize;
+      Slot* slot = reinterpret_cast<Slot*>(end_);
+      slot->next = head;
+      head = slot;
+    }
+    magazine.head = head;
+    magazine.count = MAGAZINE_SLOTS;
+  }
+
+  std::atomic<uint64_t> depot_{0};  // Tagged top of the depot stack
+  std::atomic<size_t> slab_bytes_{0};
+
+  std::mutex carve_lock_;  // Protects the current slab
+  char* slab_ = nullptr;   // Start of the current slab
+  char* end_ = nullptr;    // End of its slots not yet handed out
+};
+
+// Stateless allocator over the ConcurrentSlotPool of its node size, for
+// node-based containers shared between threads. All instances compare equal,
+// so nodes can be freed by any list and any thread. Requests for several
+// objects, or objects too large or too aligned for a slot, go to operator
+// new.
+template <typename T>
+class ConcurrentPoolAllocator {
+ public:
+  using value_type = T;
+  using pointer = T*;
+  using const_pointer = const T*;
+  using size_type = std::size_t;
+  using difference_type = std::ptrdiff_t;
+  using is_always_equal = std::true_type;
+
+  template <typename U>
+  struct rebind {
+    using other = ConcurrentPoolAllocator<U>;
+  };
+
+  ConcurrentPoolAllocator() noexcept = default;
+
+  template <typename U>
+  ConcurrentPoolAllocator(const ConcurrentPoolAllocator<U>&) noexcept {}
+
+  pointer allocate(size_type n) {
+    if (n == 1 && POOLED) {
+      return static_cast<pointer>(Pool::instance().allocate());
+    }
+    if (n > std::numeric_limits<size_type>::max() / sizeof(T)) {
+      throw std::bad_alloc();
+    }
+    return static_cast<pointer>(
+        ::operator new(n * sizeof(T), std::align_val_t(alignof(T))));
+  }
+
+  void deallocate(pointer p, size_type n) noexcept {
+    if (n == 1 && POOLED) {
+      Pool::instance().deallocate(p);
+    } else {
+      ::operator delete(p, std::align_val_t(alignof(T)));
+    }
+  }
+
+  // Bytes of slabs behind allocators of this node size
+  static size_t slab_bytes() noexcept { return Pool::instance().slab_bytes(); }
+
+ private:
+  static constexpr size_t SLOT_ALIGNMENT = alignof(std::max_align_t);
+  static constexpr size_t MAX_SLOT = 256;
+  static constexpr size_t SLOT_SIZE =
+      (sizeof(T) + SLOT_ALIGNMENT - 1) / SLOT_ALIGNMENT * SLOT_ALIGNMENT;
+  static constexpr bool POOLED =
+      SLOT_SIZE <= MAX_SLOT && alignof(T) <= SLOT_ALIGNMENT;
+
+  using Pool = ConcurrentSlotPool<POOLED ? SLOT_SIZE : SLOT_ALIGNMENT>;
+};
+
+template <typename T, typename U>
+bool operator==(const ConcurrentPoolAllocator<T>&,
+                const ConcurrentPoolAllocator<U>&) noexcept {
+  return true;
+}
+
+template <typename T, typename U>
+bool operator!=(const ConcurrentPoolAllocator<T>&,
+                const ConcurrentPoolAllocator<U>&) noexcept {
+  return false;
+}
+
+#endif  // CONCURRENT_POOL_ALLOCATOR_H
@@ -1,126 +1,498 @@
 #ifndef LINKED_LIST_H
 #define LINKED_LIST_H
 
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <initializer_list>
+#include <iterator>
 #include <memory>
+#include <type_traits>
+#include <utility>
 
 #include "StackAllocator.h"
 
+// Allocators whose allocate(n) blocks may be released one object at a time
+// with deallocate(p, 1) declare 'bulk_allocation' as std::true_type.
+// LinkedList then builds a range of nodes with a single allocate(n) call.
+template <typename Alloc, typename = void>
+struct SupportsBulkAllocation : std::false_type {};
+template <typename Alloc>
+struct SupportsBulkAllocation<Alloc,
+                              std::void_t<typename Alloc::bulk_allocation>>
+    : Alloc::bulk_allocation {};
+
 template <typename T, typename Alloc = StackAllocator<T>>
 class LinkedList {
  public:
-  struct Node {
-    T data;
+  struct Node;
+
+  // Link part of a node. The list's head is a Link too, so before_begin()
+  // and insert_after() treat the front like any other position.
+  struct Link {
     Node* next;
   };
 
+  struct Node : Link {
+    T data;
+  };
+
   using allocator_type =
       typename std::allocator_traits<Alloc>::template rebind_alloc<Node>;
-  using value_type = typename std::allocator_traits<allocator_type>::value_type;
-  using pointer = typename std::allocator_traits<allocator_type>::pointer;
-  using size_type = typename std::allocator_traits<allocator_type>::size_type;
+  using traits = std::allocator_traits<allocator_type>;
+  using value_type = T;
+  using pointer = typename traits::pointer;
+  using size_type = typename traits::size_type;
+
+  LinkedList() : head_{nullptr}, tail_(nullptr), size_(0), allocator_() {}
 
-  LinkedList() : head_(nullptr), allocator_() {}
+  // Allocators without a default state, such as ArenaAllocator, are passed in
+  explicit LinkedList(const Alloc& alloc)
+      : head_{nullptr}, tail_(nullptr), size_(0), allocator_(alloc) {}
 
   LinkedList(const std::initializer_list<T>& list)
-      : head_(nullptr), allocator_() {
-    for (auto it = list.begin(); it != list.end(); ++it) {
-      push_back(*it);
-    }
+      : head_{nullptr}, tail_(nullptr), size_(0), allocator_() {
+    insert_after(before_begin(), list.begin(), list.end());
+  }
+
+  LinkedList(const std::initializer_list<T>& list, const Alloc& alloc)
+      : head_{nullptr}, tail_(nullptr), size_(0), allocator_(alloc) {
+    insert_after(before_begin(), list.begin(), list.end());
+  }
+
+  // Builds the list from a range; see insert_after() for the allocation
+  template <typename InputIt, typename = typename std::iterator_traits<
+                                  InputIt>::iterator_category>
+  LinkedList(InputIt first, InputIt last)
+      : head_{nullptr}, tail_(nullptr), size_(0), allocator_() {
+    insert_after(before_begin(), first, last);
+  }
+
+  template <typename InputIt, typename = typename std::iterator_traits<
+                                  InputIt>::iterator_category>
+  LinkedList(InputIt first, InputIt last, const Alloc& alloc)
+      : head_{nullptr}, tail_(nullptr), size_(0), allocator_(alloc) {
+    insert_after(before_begin(), first, last);
   }
 
   LinkedList(const LinkedList& other)
-      : head_(nullptr),
-        allocator_(
-            std::allocator_traits<allocator_type>::
-                select_on_container_copy_construction(other.get_allocator())) {
-    for (auto it = other.begin(); it != other.end(); ++it) {
-      push_back(*it);
+      : head_{nullptr},
+        tail_(nullptr),
+        size_(0),
+        allocator_(traits::select_on_container_copy_construction(
+            other.get_allocator())) {
+    insert_n(before_begin(), other.begin(), other.size_);
+  }
+
+  // Takes over the nodes of 'other' when the allocators are equal. The
+  // allocator is copied rather than moved, so 'other' stays usable. An
+  // allocator that owns its storage, like StackAllocator, only equals
+  // itself, so its elements are moved into nodes of the new list instead.
+  LinkedList(LinkedList&& other) noexcept(traits::is_always_equal::value)
+      : head_{nullptr},
+        tail_(nullptr),
+        size_(0),
+        allocator_(other.allocator_) {
+    if (traits::is_always_equal::value || allocator_ == other.allocator_) {
+      steal(other);
+    } else {
+      move_elements(other);
     }
   }
+
   ~LinkedList() { clear(); }
 
   LinkedList& operator=(const LinkedList& other) {
     if (this != &other) {
       clear();
-      if (std::allocator_traits<
-              allocator_type>::propagate_on_container_copy_assignment::value) {
+      // Not every allocator is assignable; std::pmr::polymorphic_allocator
+      // stays with its container
+      if constexpr (traits::propagate_on_container_copy_assignment::value) {
         allocator_ = other.allocator_;
       }
-      for (auto it = other.begin(); it != other.end(); ++it) {
-        push_back(*it);
+      insert_n(before_begin(), other.begin(), other.size_);
+    }
+    return *this;
+  }
+
+  // Takes over the nodes of 'other' when its allocator comes along or the
+  // two allocators are equal; otherwise moves the elements one by one
+  LinkedList& operator=(LinkedList&& other) noexcept(
+      traits::propagate_on_container_move_assignment::value ||
+      traits::is_always_equal::value) {
+    if (this != &other) {
+      clear();
+      if constexpr (traits::propagate_on_container_move_assignment::value) {
+        allocator_ = other.allocator_;
+        steal(other);
+      } else if (traits::is_always_equal::value ||
+                 allocator_ == other.allocator_) {
+        steal(other);
+      } else {
+        move_elements(other);
       }
     }
     return *this;
   }
 
-  void push_front(const T& value) {
-    pointer new_node = allocator_.allocate(1);
-    std::allocator_traits<allocator_type>::construct(allocator_, new_node,
-                                                     Node{value, head_});
-    head_ = new_node;
+  // Replaces the elements with those of a range
+  template <typename InputIt>
+  void assign(InputIt first, InputIt last) {
+    clear();
+    insert_after(before_begin(), first, last);
   }
 
-  void push_back(const T& value) {
-    pointer new_node = allocator_.allocate(1);
-    std::allocator_traits<allocator_type>::construct(allocator_, new_node,
-                                                     Node{value, nullptr});
-    if (head_ == nullptr) {
-      head_ = new_node;
+  void push_front(const T& value) { emplace_front(value); }
+  void push_front(T&& value) { emplace_front(std::move(value)); }
+
+  void push_back(const T& value) { emplace_back(value); }
+  void push_back(T&& value) { emplace_back(std::move(value)); }
+
+  // Constructs the element in place in a new first node
+  template <typename... Args>
+  T& emplace_front(Args&&... args) {
+    Node* node = create_node(std::forward<Args>(args)...);
+    node->next = head_.next;
+    head_.next = node;
+    if (tail_ == nullptr) {
+      tail_ = node;
+    }
+    ++size_;
+    return node->data;
+  }
+
+  // Constructs the element in place in a new last node, in O(1)
+  template <typename... Args>
+  T& emplace_back(Args&&... args) {
+    Node* node = create_node(std::forward<Args>(args)...);
+    if (tail_ == nullptr) {
+      head_.next = node;
     } else {
-      Node* temp = head_;
-      while (temp->next) {
-        temp = temp->next;
-      }
-      temp->next = new_node;
+      tail_->next = node;
     }
+    tail_ = node;
+    ++size_;
+    return node->data;
   }
 
   void pop_front() {
-    if (head_) {
-      pointer temp = head_;
-      head_ = head_->next;
-      std::allocator_traits<allocator_type>::destroy(allocator_, temp);
+    if (head_.next) {
+      pointer temp = head_.next;
+      head_.next = temp->next;
+      if (head_.next == nullptr) {
+        tail_ = nullptr;
+      }
+      --size_;
+      traits::destroy(allocator_, std::addressof(temp->data));
       allocator_.deallocate(temp, 1);
     }
   }
 
   void clear() {
-    while (head_) {
+    while (head_.next) {
       pop_front();
     }
   }
 
+  // Relocates the elements into fresh nodes laid out in list order, so a
+  // list scattered by long runs of pushes and pops iterates sequentially
+  // again. With bulk_allocation the nodes are one allocate(n) block;
+  // otherwise they are allocated one at a time, in order, and are only as
+  // contiguous as the allocator makes them: malloc hands back freed nodes in
+  // the scattered order they were freed in. Elements are moved when that
+  // cannot throw and copied otherwise; if anything throws, the list is left
+  // as it was. The old nodes go back to the allocator, and StackAllocator or
+  // StackArena only reuse them after a rollback.
+  void compact() {
+    if (size_ == 0) {
+      return;
+    }
+
+    Node* fresh = allocate_chain(size_);
+    Node* target = fresh;
+    Node* source = head_.next;
+    try {
+      for (; source != nullptr; source = source->next) {
+        traits::construct(allocator_, std::addressof(target->data),
+                          std::move_if_noexcept(source->data));
+        target = target->next;
+      }
+    } catch (...) {
+      for (Node* node = fresh; node != target; node = node->next) {
+        traits::destroy(allocator_, std::addressof(node->data));
+      }
+      release_chain(fresh, size_);
+      throw;
+    }
+
+    size_t n = size_;
+    clear();
+    head_.next = fresh;
+    size_ = n;
+    for (tail_ = fresh; tail_->next != nullptr; tail_ = tail_->next) {
+    }
+  }
+
+  // Sorts the list stably by relinking nodes, without moving or copying any
+  // element. Bottom-up merge sort: runs of 1, 2, 4, ... nodes are merged in
+  // bins, so it takes O(n log n) comparisons and no recursion.
+  template <typename Compare = std::less<>>
+  void sort(Compare comp = Compare()) {
+    if (size_ < 2) {
+      return;
+    }
+
+    // bins[i] is empty or a sorted run of 2^i nodes; higher bins hold
+    // earlier elements
+    Node* bins[64] = {};
+    size_t used = 0;
+    Node* rest = head_.next;
+    while (rest != nullptr) {
+      Node* carry = rest;
+      rest = rest->next;
+      carry->next = nullptr;
+
+      size_t i = 0;
+      for (; bins[i] != nullptr; ++i) {
+        carry = merge(bins[i], carry, comp);
+        bins[i] = nullptr;
+      }
+      bins[i] = carry;
+      used = std::max(used, i + 1);
+    }
+
+    Node* sorted = nullptr;
+    for (size_t i = 0; i < used; ++i) {
+      if (bins[i] != nullptr) {
+        sorted = merge(bins[i], sorted, comp);
+      }
+    }
+    head_.next = sorted;
+    for (tail_ = sorted; tail_->next != nullptr; tail_ = tail_->next) {
+    }
+  }
+
+  size_type size() const noexcept { return size_; }
+
   allocator_type get_allocator() const noexcept { return allocator_; }
 
   // Iterator for LinkedList
   class iterator {
    public:
-    iterator(Node* node) : node_(node) {}
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = T;
+    using difference_type = std::ptrdiff_t;
+    using pointer = T*;
+    using reference = T&;
+
+    iterator(Link* link) : link_(link) {}
 
-    T& operator*() { return node_->data; }
+    T& operator*() { return static_cast<Node*>(link_)->data; }
 
     iterator& operator++() {
-      node_ = node_->next;
+      link_ = link_->next;
       return *this;
     }
 
+    iterator operator++(int) {
+      iterator old = *this;
+      ++*this;
+      return old;
+    }
+
     bool operator!=(const iterator& other) const {
-      return node_ != other.node_;
+      return link_ != other.link_;
     }
 
     bool operator==(const iterator& other) const {
-      return node_ == other.node_;
+      return link_ == other.link_;
     }
 
    private:
-    Node* node_;
+    friend class LinkedList;
+    Link* link_;
   };
 
-  iterator begin() const { return iterator(head_); }
+  // Position before the first element, only for insert_after() and ++
+  iterator before_begin() const {
+    return iterator(const_cast<Link*>(&head_));
+  }
+  iterator begin() const { return iterator(head_.next); }
   iterator end() const { return iterator(nullptr); }
 
+  // Inserts copies of [first, last) after 'pos' and returns the last one
+  // inserted, or 'pos' for an empty range. For forward ranges and
+  // allocators with bulk_allocation, all nodes come from one allocate(n)
+  // call, laid out in list order and linked in a single pass.
+  template <typename InputIt>
+  iterator insert_after(iterator pos, InputIt first, InputIt last) {
+    using Category = typename std::iterator_traits<InputIt>::iterator_category;
+    if constexpr (SupportsBulkAllocation<allocator_type>::value &&
+                  std::is_base_of<std::forward_iterator_tag, Category>::value) {
+      return insert_n(pos, first, std::distance(first, last));
+    } else {
+      Link* link = pos.link_;
+      for (; first != last; ++first) {
+        Node* node = create_node(*first);
+        splice_chain(link, node, node, 1);
+        link = node;
+      }
+      return iterator(link);
+    }
+  }
+
  private:
-  Node* head_;
+  // Function to insert copies of the n elements starting at 'first' after
+  // 'pos', for callers that know the length without walking the range
+  template <typename ForwardIt>
+  iterator insert_n(iterator pos, ForwardIt first, size_t n) {
+    if (n == 0) {
+      return pos;
+    }
+    if constexpr (SupportsBulkAllocation<allocator_type>::value) {
+      Node* nodes = create_nodes(n, first);
+      splice_chain(pos.link_, nodes, nodes + n - 1, n);
+      return iterator(nodes + n - 1);
+    } else {
+      Link* link = pos.link_;
+      for (size_t i = 0; i < n; ++i, ++first) {
+        Node* node = create_node(*first);
+        splice_chain(link, node, node, 1);
+        link = node;
+      }
+      return iterator(link);
+    }
+  }
+
+  // Function to allocate a node and construct its element in place; the
+  // link is left for the caller to set
+  template <typename... Args>
+  Node* create_node(Args&&... args) {
+    pointer node = allocator_.allocate(1);
+    try {
+      traits::construct(allocator_, std::addressof(node->data),
+                        std::forward<Args>(args)...);
+    } catch (...) {
+      allocator_.deallocate(node, 1);
+      throw;
+    }
+    node->next = nullptr;
+    return node;
+  }
+
+  // Function to allocate n contiguous nodes, construct them from the range
+  // starting at 'first' and link them in order; the last link is nullptr
+  template <typename ForwardIt>
+  Node* create_nodes(size_t n, ForwardIt first) {
+    pointer nodes = allocator_.allocate(n);
+    size_t i = 0;
+    try {
+      for (; i < n; ++i, ++first) {
+        traits::construct(allocator_, std::addressof(nodes[i].data), *first);
+        nodes[i].next = nodes + i + 1;
+      }
+      nodes[n - 1].next = nullptr;
+    } catch (...) {
+      while (i > 0) {
+        traits::destroy(allocator_, std::addressof(nodes[--i].data));
+      }
+      allocator_.deallocate(nodes, n);
+      throw;
+    }
+    return nodes;
+  }
+
+  // Function to allocate n nodes without constructing their elements,
+  // linked in order; the last link is nullptr
+  Node* allocate_chain(size_t n) {
+    if constexpr (SupportsBulkAllocation<allocator_type>::value) {
+      pointer nodes = allocator_.allocate(n);
+      for (size_t i = 0; i + 1 < n; ++i) {
+        nodes[i].next = nodes + i + 1;
+      }
+      nodes[n - 1].next = nullptr;
+      return nodes;
+    } else {
+      Link first{nullptr};
+      Link* last = &first;
+      try {
+        for (size_t i = 0; i < n; ++i) {
+          Node* node = allocator_.allocate(1);
+          node->next = nullptr;
+          last->next = node;
+          last = node;
+        }
+      } catch (...) {
+        release_chain(first.next, n);
+        throw;
+      }
+      return first.next;
+    }
+  }
+
+  // Function to free a chain from allocate_chain() whose elements are
+  // destroyed or were never constructed; a chain cut short by a failed
+  // allocation ends early
+  void release_chain(Node* chain, size_t n) noexcept {
+    if constexpr (SupportsBulkAllocation<allocator_type>::value) {
+      allocator_.deallocate(chain, n);
+    } else {
+      while (chain != nullptr) {
+        Node* next = chain->next;
+        allocator_.deallocate(chain, 1);
+        chain = next;
+      }
+    }
+  }
+
+  // Function to merge two sorted chains; on ties, nodes of 'first' go first
+  template <typename Compare>
+  static Node* merge(Node* first, Node* second, Compare& comp) {
+    Link merged{nullptr};
+    Link* last = &merged;
+    while (first != nullptr && second != nullptr) {
+      if (comp(second->data, first->data)) {
+        last->next = second;
+        second = second->next;
+      } else {
+        last->next = first;
+        first = first->next;
+      }
+      last = last->next;
+    }
+    last->next = first != nullptr ? first : second;
+    return merged.next;
+  }
+
+  // Function to link the chain [first, last] of 'count' nodes in after 'link'
+  void splice_chain(Link* link, Node* first, Node* last,
+                    size_t count) noexcept {
+    size_ += count;
+    last->next = link->next;
+    link->next = first;
+    if (last->next == nullptr) {
+      tail_ = last;
+    }
+  }
+
+  // Function to take over the nodes of 'other', leaving it empty
+  void steal(LinkedList& other) noexcept {
+    head_.next = std::exchange(other.head_.next, nullptr);
+    tail_ = std::exchange(other.tail_, nullptr);
+    size_ = std::exchange(other.size_, 0);
+  }
+
+  // Function to move the elements of 'other' into new nodes, leaving it empty
+  void move_elements(LinkedList& other) {
+    for (Node* node = other.head_.next; node != nullptr; node = node->next) {
+      emplace_back(std::move(node->data));
+    }
+    other.clear();
+  }
+
+  Link head_;   // Link to the first node
+  Node* tail_;  // Last node, so push_back does not walk the list
+  size_t size_;
   allocator_type allocator_;
 };
 
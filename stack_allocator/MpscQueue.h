@@ -0,0 +1,133 @@
+#ifndef MPSC_QUEUE_H
+#define MPSC_QUEUE_H
+
+#include <atomic>
+#include <memory>
+#include <new>
+#include <utility>
+
+// Unbounded multi-producer single-consumer queue after Dmitry Vyukov's
+// intrusive MPSC design. Nodes come from Alloc, rebound to Node like in
+// LinkedList; producers allocate them and the consumer frees them, so Alloc
+// must be safe to call from several threads at once. ConcurrentPoolAllocator
+// keeps malloc off the hot path.
+//
+// A push is one atomic exchange and one store, whatever the number of
+// producers; a pop touches no shared counters. The queue always holds one
+// node without a value, the stub, which the consumer's tail points at.
+//
+// The queue is not linearizable: a producer stalled between its exchange and
+// its store hides the elements pushed after it until it resumes, and
+// try_pop() reports the queue empty meanwhile.
+template <typename T, typename Alloc = std::allocator<T>>
+class MpscQueue {
+ public:
+  struct Node {
+    std::atomic<Node*> next;
+    alignas(T) unsigned char storage[sizeof(T)];  // Empty in the stub
+
+    T* value() noexcept {
+      return std::launder(reinterpret_cast<T*>(storage));
+    }
+  };
+
+  using allocator_type =
+      typename std::allocator_traits<Alloc>::template rebind_alloc<Node>;
+  using traits = std::allocator_traits<allocator_type>;
+  using value_type = T;
+
+  MpscQueue() : MpscQueue(Alloc()) {}
+
+  // Allocators without a default state are passed in
+  explicit MpscQueue(const Alloc& alloc) : allocator_(alloc) {
+    Node* stub = create_node();
+    head_.store(stub, std::memory_order_relaxed);
+    tail_ = stub;
+  }
+
+  MpscQueue(const MpscQueue&) = delete;
+  MpscQueue& operator=(const MpscQueue&) = delete;
+
+  // Must run once all producers are done
+  ~MpscQueue() {
+    while (pop_node()) {
+    }
+    allocator_.deallocate(tail_, 1);
+  }
+
+  void push(const T& value) { emplace(value); }
+  void push(T&& value) { emplace(std::move(value)); }
+
+  // Constructs the element in a new node and links it in; safe to call from
+  // any number of threads
+  template <typename... Args>
+  void emplace(Args&&... args) {
+    Node* node = create_node();
+    try {
+      traits::construct(allocator_, node->value(),
+                        std::forward<Args>(args)...);
+    } catch (...) {
+      allocator_.deallocate(node, 1);
+      throw;
+    }
+
+    // The exchange orders producers; until the store, the new node is only
+    // reachable through head_
+    Node* prev = head_.exchange(node, std::memory_order_acq_rel);
+    prev->next.store(node, std::memory_order_release);
+  }
+
+  // Moves the oldest element into 'out' and returns true, or returns false
+  // when nothing is visible yet. Consumer only.
+  bool try_pop(T& out) {
+    Node* next = tail_->next.load(std::memory_order_acquire);
+    if (next == nullptr) {
+      return false;
+    }
+    out = std::move(*next->value());
+    advance(next);
+    return true;
+  }
+
+  // Returns true when no element is visible to the consumer. Consumer only.
+  bool empty() const {
+    return tail_->next.load(std::memory_order_acquire) == nullptr;
+  }
+
+  allocator_type get_allocator() const noexcept { return allocator_; }
+
+ private:
+  // Function to allocate a node with no successor and no value yet
+  Node* create_node() {
+    Node* node = allocator_.allocate(1);
+    ::new (static_cast<void*>(&node->next)) std::atomic<Node*>(nullptr);
+    return node;
+  }
+
+  // Function to make 'next' the stub once its value is taken: its value is
+  // destroyed and the old stub goes back to the allocator
+  void advance(Node* next) {
+    traits::destroy(allocator_, next->value());
+    Node* old = tail_;
+    tail_ = next;
+    allocator_.deallocate(old, 1);
+  }
+
+  // Function to drop the oldest element, returning false when there is none
+  bool pop_node() {
+    Node* next = tail_->next.load(std::memory_order_acquire);
+    if (next == nullptr) {
+      return false;
+    }
+    advance(next);
+    return true;
+  }
+
+  // Producers and the consumer write different ends; keep them on separate
+  // cache lines
+  alignas(64) std::atomic<Node*> head_;  // Newest node, producers only
+  alignas(64) Node* tail_;               // Stub before the oldest element
+  allocator_type allocator_;
+};
+
+#endif  // MPSC_QUEUE_H
@@ -0,0 +1,227 @@
+#ifndef POOL_ALLOCATOR_H
+#define POOL_ALLOCATOR_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <new>
+#include <type_traits>
+
+// Fixed-size slot pool behind PoolAllocator. Slots come in size classes of
+// SLOT_ALIGNMENT steps up to MAX_SLOT bytes; each class carves slabs into
+// slots and keeps freed slots on an intrusive free list, so allocating and
+// freeing a node are a handful of instructions. Slabs grow geometrically up
+// to MAX_SLAB bytes and are only released with the pool. Single-threaded.
+class NodePool {
+ public:
+  static constexpr size_t SLOT_ALIGNMENT = alignof(std::max_align_t);
+  static constexpr size_t MAX_SLOT = 256;
+
+  NodePool() = default;
+  NodePool(const NodePool&) = delete;
+  NodePool& operator=(const NodePool&) = delete;
+
+  ~NodePool() {
+    for (SizeClass& c : classes_) {
+      while (c.slabs != nullptr) {
+        Slab* next = c.slabs->next;
+        ::operator delete(c.slabs);
+        c.slabs = next;
+      }
+    }
+  }
+
+  // Returns true when blocks of this size and alignment come from slots
+  static constexpr bool pooled(size_t bytes, size_t alignment) {
+    return bytes <= MAX_SLOT && alignment <= SLOT_ALIGNMENT;
+  }
+
+  void* allocate(size_t bytes) {
+    SizeClass& c = class_of(bytes);
+
+    // Reuse the most recently freed slot, else carve a fresh one
+    if (c.free != nullptr) {
+      FreeSlot* slot = c.free;
+      c.free = slot->next;
+      return slot;
+    }
+    if (c.carve == c.end) {
+      grow(c, slot_size(bytes), 1);
+    }
+    void* p = c.carve;
+    c.carve += slot_size(bytes);
+    return p;
+  }
+
+  // Carves n contiguous fresh slots, each of which may later be freed on
+  // its own. What is left of the newest slab goes to the free list when it
+  // is too short.
+  void* allocate_run(size_t bytes, size_t n) {
+    SizeClass& c = class_of(bytes);
+    size_t slot = slot_size(bytes);
+
+    if (static_cast<size_t>(c.end - c.carve) < n * slot) {
+      for (; c.carve != c.end; c.carve += slot) {
+        deallocate(c.carve, bytes);
+      }
+      grow(c, slot, n);
+    }
+    void* p = c.carve;
+    c.carve += n * slot;
+    return p;
+  }
+
+  void deallocate(void* p, size_t bytes) noexcept {
+    SizeClass& c = class_of(bytes);
+    FreeSlot* slot = static_cast<FreeSlot*>(p);
+    slot->next = c.free;
+    c.free = slot;
+  }
+
+  // Bytes taken from the system for slabs, over all size classes
+  size_t slab_bytes() const noexcept { return slab_bytes_; }
+
+ private:
+  static constexpr size_t CLASSES = MAX_SLOT / SLOT_ALIGNMENT;
+  static constexpr size_t FIRST_SLAB_SLOTS = 16;
+  static constexpr size_t MAX_SLAB = 64 * 1024;
+
+  struct FreeSlot {
+    FreeSlot* next;
+  };
+
+  // Header of a slab, padded so the slots after it stay aligned
+  struct alignas(std::max_align_t) Slab {
+    Slab* next;
+  };
+
+  struct SizeClass {
+    FreeSlot* free = nullptr;  // Freed slots, most recent first
+    char* carve = nullptr;     // Next never-used slot of the newest slab
+    char* end = nullptr;       // End of the newest slab
+    Slab* slabs = nullptr;     // All slabs, newest first
+    size_t next_slots = FIRST_SLAB_SLOTS;
+  };
+
+  static size_t slot_size(size_t bytes) noexcept {
+    size_t size = (bytes + SLOT_ALIGNMENT - 1) & ~(SLOT_ALIGNMENT - 1);
+    return size != 0 ? size : SLOT_ALIGNMENT;
+  }
+
+  SizeClass& class_of(size_t bytes) noexcept {
+    return classes_[slot_size(bytes) / SLOT_ALIGNMENT - 1];
+  }
+
+  // Function to add a slab to a size class, twice as big as the last one
+  // and at least 'min_slots' long
+  void grow(SizeClass& c, size_t slot, size_t min_slots) {
+    size_t slots = std::max(c.next_slots, min_slots);
+    size_t bytes = sizeof(Slab) + slots * slot;
+
+    Slab* slab = static_cast<Slab*>(::operator new(bytes));
+    slab->next = c.slabs;
+    c.slabs = slab;
+    c.carve = reinterpret_cast<char*>(slab + 1);
+    c.end = c.carve + slots * slot;
+    slab_bytes_ += bytes;
+
+    if (2 * c.next_slots * slot <= MAX_SLAB) {
+      c.next_slots *= 2;
+    }
+  }
+
+  SizeClass classes_[CLASSES];
+  size_t slab_bytes_ = 0;
+};
+
+// Allocator handle for a NodePool, meant for node-based containers. A
+// default-constructed allocator creates a pool; copies and rebinds share it
+// and compare equal, and the pool is freed with the last handle. When T
+// fills its slots exactly, requests for several objects carve a run of
+// contiguous slots that can be freed together or one at a time, so a list
+// can take all its nodes at once. Slots are not merged again, so containers
+// that reallocate growing arrays belong on another allocator. Other arrays,
+// and objects too large or too aligned for a slot, go to operator new.
+template <typename T>
+class PoolAllocator {
+ public:
+  using value_type = T;
+  using pointer = T*;
+  using const_pointer = const T*;
+  using void_pointer = void*;
+  using const_void_pointer = const void*;
+  using size_type = std::size_t;
+  using difference_type = std::ptrdiff_t;
+
+  // Nodes stay in the pool they came from, so the pool goes with them
+  using propagate_on_container_copy_assignment = std::true_type;
+  using propagate_on_container_move_assignment = std::true_type;
+  using propagate_on_container_swap = std::true_type;
+
+  // Blocks of several objects may be freed one object at a time, as long as
+  // the objects sit on slot boundaries
+  using bulk_allocation = std::bool_constant<
+      NodePool::pooled(sizeof(T), alignof(T)) &&
+      sizeof(T) % NodePool::SLOT_ALIGNMENT == 0>;
+
+  template <typename U>
+  struct rebind {
+    using other = PoolAllocator<U>;
+  };
+
+  PoolAllocator() : pool_(std::make_shared<NodePool>()) {}
+
+  // Moves copy: a container moved from keeps its pool and stays usable, as
+  // the standard requires of every allocator
+  PoolAllocator(const PoolAllocator&) noexcept = default;
+  PoolAllocator& operator=(const PoolAllocator&) noexcept = default;
+
+  template <typename U>
+  PoolAllocator(const PoolAllocator<U>& other) noexcept
+      : pool_(other.pool()) {}
+
+  pointer allocate(size_type n) {
+    if (n > std::numeric_limits<size_type>::max() / NodePool::MAX_SLOT) {
+      throw std::bad_alloc();
+    }
+    if (n == 1 && NodePool::pooled(sizeof(T), alignof(T))) {
+      return static_cast<pointer>(pool_->allocate(sizeof(T)));
+    }
+    if (bulk_allocation::value) {
+      return static_cast<pointer>(pool_->allocate_run(sizeof(T), n));
+    }
+    return static_cast<pointer>(
+        ::operator new(n * sizeof(T), std::align_val_t(alignof(T))));
+  }
+
+  void deallocate(pointer p, size_type n) noexcept {
+    if (n == 1 && NodePool::pooled(sizeof(T), alignof(T))) {
+      pool_->deallocate(p, sizeof(T));
+    } else if (bulk_allocation::value) {
+      for (size_type i = 0; i < n; ++i) {
+        pool_->deallocate(p + i, sizeof(T));
+      }
+    } else {
+      ::operator delete(p, std::align_val_t(alignof(T)));
+    }
+  }
+
+  const std::shared_ptr<NodePool>& pool() const noexcept { return pool_; }
+
+ private:
+  std::shared_ptr<NodePool> pool_;
+};
+
+template <typename T, typename U>
+bool operator==(const PoolAllocator<T>& a, const PoolAllocator<U>& b) noexcept {
+  return a.pool() == b.pool();
+}
+
+template <typename T, typename U>
+bool operator!=(const PoolAllocator<T>& a, const PoolAllocator<U>& b) noexcept {
+  return !(a == b);
+}
+
+#endif  // POOL_ALLOCATOR_H
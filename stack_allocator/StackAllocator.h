@@ -2,8 +2,14 @@
 #define STACK_ALLOCATOR_H
 
 #include <cstddef>
+#include <new>
 #include <stdexcept>
+#include <type_traits>
+#include <utility>
 
+// Bump allocator over an inline buffer of N objects. Blocks are carved off
+// the top in order; freeing the topmost block gives its space back, other
+// frees are deferred until a rollback() past them.
 template <typename T, size_t N = 1024>
 class StackAllocator {
  public:
@@ -15,6 +21,12 @@ class StackAllocator {
   using size_type = std::size_t;
   using difference_type = std::ptrdiff_t;
 
+  // Position of the top of the stack, see marker() and rollback()
+  using marker_type = size_t;
+
+  // Blocks of several objects may be freed one object at a time
+  using bulk_allocation = std::true_type;
+
   template <typename U>
   struct rebind {
     using other = StackAllocator<U, N>;
@@ -22,6 +34,17 @@ class StackAllocator {
 
   StackAllocator() : offset_(0) {}
 
+  // The buffer holds the blocks of the allocator's own container, so copies
+  // and rebinds start out empty instead of duplicating them; a container
+  // moved into one then has the whole buffer for its elements
+  StackAllocator(const StackAllocator&) noexcept : offset_(0) {}
+
+  template <typename U>
+  StackAllocator(const StackAllocator<U, N>&) noexcept : offset_(0) {}
+
+  // Live blocks stay where they are, so assignment keeps this buffer
+  StackAllocator& operator=(const StackAllocator&) noexcept { return *this; }
+
   pointer allocate(size_type n) {
     if (offset_ + n > N) {
       throw std::bad_alloc();
@@ -31,8 +54,23 @@ class StackAllocator {
     return p;
   }
 
-  void deallocate(pointer, size_type) {
-    // Simplified for demonstration purposes
+  // Frees in LIFO order rewind the top of the stack, so a container that
+  // pushes and pops keeps reusing the same space
+  void deallocate(pointer p, size_type n) {
+    if (p + n == top()) {
+      offset_ -= n;
+    }
+  }
+
+  // Returns the current top of the stack, to roll back to later
+  marker_type marker() const noexcept { return offset_; }
+
+  // Frees everything allocated since 'marker' was taken, in O(1). Objects in
+  // that range are not destroyed; their owners must be done with them.
+  void rollback(marker_type marker) noexcept {
+    if (marker < offset_) {
+      offset_ = marker;
+    }
   }
 
   template <typename U, typename... Args>
@@ -46,8 +84,43 @@ class StackAllocator {
   }
 
  private:
+  pointer top() noexcept {
+    return reinterpret_cast<pointer>(&data_[offset_ * sizeof(value_type)]);
+  }
+
   alignas(alignof(value_type)) char data_[N * sizeof(value_type)];
   size_t offset_;
 };
 
+// Each allocator owns its buffer, so an allocator only equals itself and
+// memory from one can never be freed through another
+template <typename T, typename U, size_t N>
+bool operator==(const StackAllocator<T, N>& a,
+                const StackAllocator<U, N>& b) noexcept {
+  return static_cast<const void*>(&a) == static_cast<const void*>(&b);
+}
+
+template <typename T, typename U, size_t N>
+bool operator!=(const StackAllocator<T, N>& a,
+                const StackAllocator<U, N>& b) noexcept {
+  return !(a == b);
+}
+
+// RAII scope for a stack allocator: everything allocated from 'allocator'
+// while the scope is alive is freed at once when it ends
+template <typename Alloc>
+class StackScope {
+ public:
+  explicit StackScope(Alloc& allocator)
+      : allocator_(allocator), marker_(allocator.marker()) {}
+  ~StackScope() { allocator_.rollback(marker_); }
+
+  StackScope(const StackScope&) = delete;
+  StackScope& operator=(const StackScope&) = delete;
+
+ private:
+  Alloc& allocator_;
+  typename Alloc::marker_type marker_;
+};
+
 #endif  // STACK_ALLOCATOR_H
@@ -0,0 +1,309 @@
+#ifndef STACK_ARENA_H
+#define STACK_ARENA_H
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory_resource>
+#include <new>
+#include <type_traits>
+
+// Bump-allocation region over a caller-provided buffer, on the stack or the
+// heap. The arena does not own the buffer, which must outlive it. Any number
+// of ArenaAllocator handles can share one arena, so the containers serving
+// one request allocate from the same cache-hot region and are freed together
+// with rollback() or reset().
+//
+// With an upstream resource, an exhausted arena chains further blocks taken
+// from it, each twice the size of the last, instead of failing. They go back
+// upstream together on reset() and destruction, so the common small case
+// stays inside the buffer while rare large ones still succeed.
+class StackArena {
+ public:
+  // Position of the top of the arena, see marker() and rollback()
+  struct marker_type {
+    void* chunk;    // Block the top was in, nullptr for the buffer
+    size_t offset;  // Top within that block
+  };
+
+  StackArena(void* buffer, size_t size,
+             std::pmr::memory_resource* upstream = nullptr) noexcept
+      : buffer_(static_cast<char*>(buffer)),
+        buffer_size_(size),
+        upstream_(upstream),
+        chunks_(nullptr),
+        next_chunk_size_(first_chunk_size()),
+        data_(buffer_),
+        size_(size),
+        offset_(0) {}
+
+  ~StackArena() { release_chunks(nullptr); }
+
+  StackArena(const StackArena&) = delete;
+  StackArena& operator=(const StackArena&) = delete;
+
+  // Returns nullptr when neither the arena nor its upstream can fit the block
+  void* allocate(size_t bytes, size_t alignment) noexcept {
+    void* p = bump(bytes, alignment);
+    if (p == nullptr && upstream_ != nullptr && grow(bytes, alignment)) {
+      p = bump(bytes, alignment);
+    }
+    return p;
+  }
+
+  // Frees in LIFO order rewind the top; other frees wait for a rollback
+  void deallocate(void* p, size_t bytes) noexcept {
+    if (static_cast<char*>(p) + bytes == data_ + offset_) {
+      offset_ = static_cast<char*>(p) - data_;
+    }
+  }
+
+  // Returns the current top of the arena, to roll back to later
+  marker_type marker() const noexcept { return {chunks_, offset_}; }
+
+  // Frees everything allocated since 'marker' was taken, in O(1) plus one
+  // upstream release per block chained since. Objects in that range are not
+  // destroyed; their owners must be done with them. The marker's block must
+  // still be chained: markers taken before a reset() or an earlier rollback
+  // past them are no longer valid.
+  void rollback(marker_type marker) noexcept {
+    assert(chained(static_cast<const Chunk*>(marker.chunk)));
+    if (marker.chunk != chunks_) {
+      release_chunks(static_cast<Chunk*>(marker.chunk));
+      offset_ = marker.offset;
+    } else if (marker.offset < offset_) {
+      offset_ = marker.offset;
+    }
+  }
+
+  // Frees everything and hands all chained blocks back upstream
+  void reset() noexcept {
+    release_chunks(nullptr);
+    offset_ = 0;
+  }
+
+  // Bytes handed out, including alignment padding. The unused tails of
+  // filled blocks are not counted, so used() stays below capacity() once
+  // blocks are chained.
+  size_t used() const noexcept {
+    return (chunks_ != nullptr ? chunks_->used_before : 0) + offset_;
+  }
+
+  // Bytes of the buffer and all chained blocks
+  size_t capacity() const noexcept {
+    return (chunks_ != nullptr ? chunks_->capacity_before : 0) + size_;
+  }
+
+ private:
+  static constexpr size_t MIN_CHUNK_SIZE = 4096;
+
+  // Header at the start of every block taken from upstream
+  struct Chunk {
+    Chunk* prev;             // Block before this one
+    size_t size;             // Size of the block including this header
+    size_t used_before;      // used() when the block was chained
+    size_t capacity_before;  // capacity() when the block was chained
+  };
+
+  // Function to size the first block chained after the buffer
+  size_t first_chunk_size() const noexcept {
+    return std::max<size_t>(2 * buffer_size_, MIN_CHUNK_SIZE);
+  }
+
+  // Function to check whether a block is the buffer's or still chained
+  bool chained(const Chunk* chunk) const noexcept {
+    const Chunk* c = chunks_;
+    while (c != chunk && c != nullptr) {
+      c = c->prev;
+    }
+    return c == chunk;
+  }
+
+  // Function to carve a block off the current region, or return nullptr
+  void* bump(size_t bytes, size_t alignment) noexcept {
+    uintptr_t base = reinterpret_cast<uintptr_t>(data_);
+    size_t start = ((base + offset_ + alignment - 1) & ~(alignment - 1)) - base;
+    if (start > size_ || bytes > size_ - start) {
+      return nullptr;
+    }
+    offset_ = start + bytes;
+    return data_ + start;
+  }
+
+  // Function to chain a block that fits 'bytes', growing geometrically
+  bool grow(size_t bytes, size_t alignment) noexcept {
+    size_t size = next_chunk_size_;
+    if (sizeof(Chunk) + alignment >= size ||
+        bytes > size - sizeof(Chunk) - alignment) {
+      if (bytes > std::numeric_limits<size_t>::max() / 2) {
+        return false;
+      }
+      size = bytes + sizeof(Chunk) + alignment;
+    }
+
+    Chunk* chunk;
+    try {
+      chunk = static_cast<Chunk*>(
+          upstream_->allocate(size, alignof(std::max_align_t)));
+    } catch (const std::bad_alloc&) {
+      return false;
+    }
+
+    chunk->prev = chunks_;
+    chunk->size = size;
+    chunk->used_before = used();
+    chunk->capacity_before = capacity();
+    chunks_ = chunk;
+    next_chunk_size_ = 2 * size;
+
+    data_ = reinterpret_cast<char*>(chunk + 1);
+    size_ = size - sizeof(Chunk);
+    offset_ = 0;
+    return true;
+  }
+
+  // Function to hand the blocks chained after 'keep' back upstream and make
+  // 'keep' the current region again. Growth resumes from 'keep', so a cycle
+  // of filling and resetting chains blocks of the same sizes every time.
+  void release_chunks(Chunk* keep) noexcept {
+    while (chunks_ != keep) {
+      Chunk* prev = chunks_->prev;
+      upstream_->deallocate(chunks_, chunks_->size, alignof(std::max_align_t));
+      chunks_ = prev;
+    }
+
+    if (keep != nullptr) {
+      data_ = reinterpret_cast<char*>(keep + 1);
+      size_ = keep->size - sizeof(Chunk);
+      next_chunk_size_ = 2 * keep->size;
+    } else {
+      data_ = buffer_;
+      size_ = buffer_size_;
+      next_chunk_size_ = first_chunk_size();
+    }
+  }
+
+  char* buffer_;                         // Caller-provided first region
+  size_t buffer_size_;
+  std::pmr::memory_resource* upstream_;  // Source of further blocks, if any
+  Chunk* chunks_;                        // Most recent chained block
+  size_t next_chunk_size_;
+
+  char* data_;     // Current region
+  size_t size_;
+  size_t offset_;  // Top within the current region
+};
+
+// StackArena together with its buffer, for arenas that live on the stack
+template <size_t Bytes>
+class InlineStackArena : public StackArena {
+ public:
+  explicit InlineStackArena(
+      std::pmr::memory_resource* upstream = nullptr) noexcept
+      : StackArena(buffer_, Bytes, upstream) {}
+
+ private:
+  alignas(std::max_align_t) char buffer_[Bytes];
+};
+
+// Allocator handle for a StackArena: a single pointer, cheap to copy, which
+// rebinds to any type while staying on the same arena. Handles compare equal
+// when they share an arena, so containers can exchange memory freely.
+template <typename T>
+class ArenaAllocator {
+ public:
+  using value_type = T;
+  using pointer = T*;
+  using const_pointer = const T*;
+  using void_pointer = void*;
+  using const_void_pointer = const void*;
+  using size_type = std::size_t;
+  using difference_type = std::ptrdiff_t;
+
+  // The arena goes wherever the elements go
+  using propagate_on_container_copy_assignment = std::true_type;
+  using propagate_on_container_move_assignment = std::true_type;
+  using propagate_on_container_swap = std::true_type;
+
+  // Blocks of several objects may be freed one object at a time
+  using bulk_allocation = std::true_type;
+
+  template <typename U>
+  struct rebind {
+    using other = ArenaAllocator<U>;
+  };
+
+  explicit ArenaAllocator(StackArena& arena) noexcept : arena_(&arena) {}
+
+  template <typename U>
+  ArenaAllocator(const ArenaAllocator<U>& other) noexcept
+      : arena_(other.arena()) {}
+
+  pointer allocate(size_type n) {
+    if (n > std::numeric_limits<size_type>::max() / sizeof(T)) {
+      throw std::bad_alloc();
+    }
+    void* p = arena_->allocate(n * sizeof(T), alignof(T));
+    if (p == nullptr) {
+      throw std::bad_alloc();
+    }
+    return static_cast<pointer>(p);
+  }
+
+  void deallocate(pointer p, size_type n) noexcept {
+    arena_->deallocate(p, n * sizeof(T));
+  }
+
+  StackArena* arena() const noexcept { return arena_; }
+
+ private:
+  StackArena* arena_;
+};
+
+template <typename T, typename U>
+bool operator==(const ArenaAllocator<T>& a,
+                const ArenaAllocator<U>& b) noexcept {
+  return a.arena() == b.arena();
+}
+
+template <typename T, typename U>
+bool operator!=(const ArenaAllocator<T>& a,
+                const ArenaAllocator<U>& b) noexcept {
+  return !(a == b);
+}
+
+// std::pmr::memory_resource over a StackArena, so std::pmr containers and
+// std::pmr::polymorphic_allocator can use the arena without a template
+// parameter of their own. Like ArenaAllocator it does not own the arena;
+// resources over the same arena compare equal. Exhausted arenas chain blocks
+// from their upstream, and without one allocate() throws std::bad_alloc.
+class ArenaResource : public std::pmr::memory_resource {
+ public:
+  explicit ArenaResource(StackArena& arena) noexcept : arena_(&arena) {}
+
+  StackArena* arena() const noexcept { return arena_; }
+
+ private:
+  void* do_allocate(size_t bytes, size_t alignment) override {
+    void* p = arena_->allocate(bytes, alignment);
+    if (p == nullptr) {
+      throw std::bad_alloc();
+    }
+    return p;
+  }
+
+  void do_deallocate(void* p, size_t bytes, size_t) override {
+    arena_->deallocate(p, bytes);
+  }
+
+  bool do_is_equal(const memory_resource& other) const noexcept override {
+    auto* resource = dynamic_cast<const ArenaResource*>(&other);
+    return resource != nullptr && resource->arena_ == arena_;
+  }
+
+  StackArena* arena_;
+};
+
+#endif  // STACK_ARENA_H
@@ -0,0 +1,303 @@
+#ifndef UNROLLED_LINKED_LIST_H
+#define UNROLLED_LINKED_LIST_H
+
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "StackAllocator.h"
+
+// Singly linked list whose nodes hold a small array of elements, sized so a
+// node fills NodeBytes (two cache lines by default). It has the interface of
+// LinkedList, but iterating chases one pointer per node instead of one per
+// element, and small elements are not dwarfed by a link each. Elements of a
+// node are contiguous, so for_each_span() hands out plain arrays that
+// compilers can vectorize over.
+//
+// A node keeps its elements in [first, last) of its array: push_front fills
+// the head node from the back, push_back fills the tail node from the front,
+// and pop_front frees a node once it is empty.
+template <typename T, typename Alloc = StackAllocator<T>,
+          size_t NodeBytes = 128>
+class UnrolledLinkedList {
+  static constexpr size_t HEADER =
+      (sizeof(void*) + 2 * sizeof(uint16_t) + alignof(T) - 1) / alignof(T) *
+      alignof(T);
+
+ public:
+  // Elements per node: as many as fit next to the header, at least one
+  static constexpr size_t NODE_ELEMENTS =
+      HEADER + sizeof(T) <= NodeBytes
+          ? ((NodeBytes - HEADER) / sizeof(T) < UINT16_MAX
+                 ? (NodeBytes - HEADER) / sizeof(T)
+                 : UINT16_MAX)
+          : 1;
+
+  struct Node {
+    Node* next;
+    uint16_t first;  // Index of the first element in use
+    uint16_t last;   // One past the last element in use
+    alignas(T) unsigned char storage[NODE_ELEMENTS * sizeof(T)];
+
+    T* data() noexcept { return std::launder(reinterpret_cast<T*>(storage)); }
+  };
+
+  using allocator_type =
+      typename std::allocator_traits<Alloc>::template rebind_alloc<Node>;
+  using traits = std::allocator_traits<allocator_type>;
+  using value_type = T;
+  using pointer = typename traits::pointer;
+  using size_type = typename traits::size_type;
+
+  UnrolledLinkedList() : head_(nullptr), tail_(nullptr), allocator_() {}
+
+  // Allocators without a default state, such as ArenaAllocator, are passed in
+  explicit UnrolledLinkedList(const Alloc& alloc)
+      : head_(nullptr), tail_(nullptr), allocator_(alloc) {}
+
+  UnrolledLinkedList(const std::initializer_list<T>& list)
+      : head_(nullptr), tail_(nullptr), allocator_() {
+    for (const T& value : list) {
+      push_back(value);
+    }
+  }
+
+  UnrolledLinkedList(const std::initializer_list<T>& list, const Alloc& alloc)
+      : head_(nullptr), tail_(nullptr), allocator_(alloc) {
+    for (const T& value : list) {
+      push_back(value);
+    }
+  }
+
+  // Copies come out densely packed, whatever the layout of 'other'
+  UnrolledLinkedList(const UnrolledLinkedList& other)
+      : head_(nullptr),
+        tail_(nullptr),
+        allocator_(traits::select_on_container_copy_construction(
+            other.get_allocator())) {
+    append_copy(other);
+  }
+
+  // Same rules as LinkedList: nodes change hands when the allocators are
+  // equal, otherwise the elements are moved into new nodes
+  UnrolledLinkedList(UnrolledLinkedList&& other) noexcept(
+      traits::is_always_equal::value)
+      : head_(nullptr), tail_(nullptr), allocator_(other.allocator_) {
+    if (traits::is_always_equal::value || allocator_ == other.allocator_) {
+      steal(other);
+    } else {
+      move_elements(other);
+    }
+  }
+
+  ~UnrolledLinkedList() { clear(); }
+
+  UnrolledLinkedList& operator=(const UnrolledLinkedList& other) {
+    if (this != &other) {
+      clear();
+      // Not every allocator is assignable; std::pmr::polymorphic_allocator
+      // stays with its container
+      if constexpr (traits::propagate_on_container_copy_assignment::value) {
+        allocator_ = other.allocator_;
+      }
+      append_copy(other);
+    }
+    return *this;
+  }
+
+  UnrolledLinkedList& operator=(UnrolledLinkedList&& other) noexcept(
+      traits::propagate_on_container_move_assignment::value ||
+      traits::is_always_equal::value) {
+    if (this != &other) {
+      clear();
+      if constexpr (traits::propagate_on_container_move_assignment::value) {
+        allocator_ = other.allocator_;
+        steal(other);
+      } else if (traits::is_always_equal::value ||
+                 allocator_ == other.allocator_) {
+        steal(other);
+      } else {
+        move_elements(other);
+      }
+    }
+    return *this;
+  }
+
+  void push_front(const T& value) { emplace_front(value); }
+  void push_front(T&& value) { emplace_front(std::move(value)); }
+
+  void push_back(const T& value) { emplace_back(value); }
+  void push_back(T&& value) { emplace_back(std::move(value)); }
+
+  // Constructs the element in place in front of the head node's elements,
+  // starting a new head node when there is no room left there
+  template <typename... Args>
+  T& emplace_front(Args&&... args) {
+    if (head_ == nullptr || head_->first == 0) {
+      Node* node = create_node(NODE_ELEMENTS);
+      T* slot = construct_at(node, NODE_ELEMENTS - 1,
+                             std::forward<Args>(args)...);
+      --node->first;
+      node->next = head_;
+      head_ = node;
+      if (tail_ == nullptr) {
+        tail_ = node;
+      }
+      return *slot;
+    }
+    T* slot = construct_at(head_, head_->first - 1,
+                           std::forward<Args>(args)...);
+    --head_->first;
+    return *slot;
+  }
+
+  // Constructs the element in place behind the tail node's elements,
+  // starting a new tail node when there is no room left there
+  template <typename... Args>
+  T& emplace_back(Args&&... args) {
+    if (tail_ == nullptr || tail_->last == NODE_ELEMENTS) {
+      Node* node = create_node(0);
+      T* slot = construct_at(node, 0, std::forward<Args>(args)...);
+      ++node->last;
+      if (tail_ == nullptr) {
+        head_ = node;
+      } else {
+        tail_->next = node;
+      }
+      tail_ = node;
+      return *slot;
+    }
+    T* slot = construct_at(tail_, tail_->last, std::forward<Args>(args)...);
+    ++tail_->last;
+    return *slot;
+  }
+
+  void pop_front() {
+    if (head_) {
+      traits::destroy(allocator_, head_->data() + head_->first);
+      if (++head_->first == head_->last) {
+        Node* temp = head_;
+        head_ = head_->next;
+        if (head_ == nullptr) {
+          tail_ = nullptr;
+        }
+        allocator_.deallocate(temp, 1);
+      }
+    }
+  }
+
+  void clear() {
+    while (head_) {
+      Node* temp = head_;
+      head_ = head_->next;
+      if constexpr (!std::is_trivially_destructible<T>::value) {
+        for (size_t i = temp->first; i < temp->last; ++i) {
+          traits::destroy(allocator_, temp->data() + i);
+        }
+      }
+      allocator_.deallocate(temp, 1);
+    }
+    tail_ = nullptr;
+  }
+
+  // Calls f(first, last) with the elements of each node, in list order, as
+  // a contiguous range
+  template <typename F>
+  void for_each_span(F&& f) const {
+    for (Node* node = head_; node != nullptr; node = node->next) {
+      f(node->data() + node->first, node->data() + node->last);
+    }
+  }
+
+  allocator_type get_allocator() const noexcept { return allocator_; }
+
+  // Iterator for UnrolledLinkedList: a node and an index into its array
+  class iterator {
+   public:
+    iterator(Node* node) : node_(node), index_(node ? node->first : 0) {}
+
+    T& operator*() { return node_->data()[index_]; }
+
+    iterator& operator++() {
+      if (++index_ == node_->last) {
+        node_ = node_->next;
+        index_ = node_ ? node_->first : 0;
+      }
+      return *this;
+    }
+
+    bool operator!=(const iterator& other) const {
+      return node_ != other.node_ || index_ != other.index_;
+    }
+
+    bool operator==(const iterator& other) const { return !(*this != other); }
+
+   private:
+    Node* node_;
+    size_t index_;
+  };
+
+  iterator begin() const { return iterator(head_); }
+  iterator end() const { return iterator(nullptr); }
+
+ private:
+  // Function to allocate an empty node whose free range starts at 'index'
+  Node* create_node(size_t index) {
+    Node* node = allocator_.allocate(1);
+    node->next = nullptr;
+    node->first = static_cast<uint16_t>(index);
+    node->last = static_cast<uint16_t>(index);
+    return node;
+  }
+
+  // Function to construct an element in slot 'index' of 'node'. A node
+  // that was just created goes back to the allocator if this throws.
+  template <typename... Args>
+  T* construct_at(Node* node, size_t index, Args&&... args) {
+    T* slot = node->data() + index;
+    try {
+      traits::construct(allocator_, slot, std::forward<Args>(args)...);
+    } catch (...) {
+      if (node->first == node->last) {
+        allocator_.deallocate(node, 1);
+      }
+      throw;
+    }
+    return slot;
+  }
+
+  // Function to append copies of the elements of 'other'
+  void append_copy(const UnrolledLinkedList& other) {
+    other.for_each_span([this](const T* first, const T* last) {
+      for (; first != last; ++first) {
+        emplace_back(*first);
+      }
+    });
+  }
+
+  // Function to take over the nodes of 'other', leaving it empty
+  void steal(UnrolledLinkedList& other) noexcept {
+    head_ = std::exchange(other.head_, nullptr);
+    tail_ = std::exchange(other.tail_, nullptr);
+  }
+
+  // Function to move the elements of 'other' into new nodes, leaving it empty
+  void move_elements(UnrolledLinkedList& other) {
+    for (Node* node = other.head_; node != nullptr; node = node->next) {
+      for (size_t i = node->first; i < node->last; ++i) {
+        emplace_back(std::move(node->data()[i]));
+      }
+    }
+    other.clear();
+  }
+
+  Node* head_;
+  Node* tail_;
+  allocator_type allocator_;
+};
+
+#endif  // UNROLLED_LINKED_LIST_H
@@ -1,11 +1,26 @@
 #include <cassert>
-#include <chrono>
+#include <cstdint>
 #include <forward_list>
 #include <iostream>
+#include <iterator>
 #include <memory>
-
+#include <memory_resource>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "CMallocResource.h"
+#include "ConcurrentPoolAllocator.h"
 #include "LinkedList.h"
+#include "MpscQueue.h"
+#include "PoolAllocator.h"
 #include "StackAllocator.h"
+#include "StackArena.h"
+#include "UnrolledLinkedList.h"
 
 // Test function for StackAllocator
 void test_stack_allocator() {
@@ -59,24 +74,6 @@ void test_linked_list() {
   std::cout << '\n';
 }
 
-template <typename ListType>
-void benchmark_list(ListType& list, int num_elements) {
-  auto start = std::chrono::high_resolution_clock::now();
-
-  for (int i = 0; i < num_elements; ++i) {
-    list.push_front(i);
-  }
-
-  for (int i = 0; i < num_elements; ++i) {
-    list.pop_front();
-  }
-
-  auto end = std::chrono::high_resolution_clock::now();
-  std::chrono::duration<double> duration = end - start;
-
-  std::cout << "Time taken: " << duration.count() << " seconds" << '\n';
-}
-
 template <typename ListType1, typename ListType2>
 bool compare_lists(const ListType1& list1, const ListType2& list2) {
   auto it1 = list1.begin();
@@ -348,31 +345,772 @@ void test_linked_list_with_custom_allocator() {
   std::cout << '\n';
 }
 
-int main() {
-  std::cout << "Testing StackAllocator..." << '\n';
-  test_stack_allocator();
+// Test function for LIFO deallocation: a list that keeps pushing and popping
+// never holds more than a few nodes, so a small arena has to be enough
+void test_stack_allocator_lifo() {
+  LinkedList<int, StackAllocator<int, 8>> list;
 
-  std::cout << "\nTesting LinkedList with StackAllocator..." << '\n';
-  test_linked_list();
+  for (int i = 0; i < 10'000; ++i) {
+    list.push_front(i);
+    list.push_front(i + 1);
+    list.pop_front();
+    list.pop_front();
+  }
+  list.push_front(42);
+  assert(*list.begin() == 42);
+
+  // Frees out of order are deferred; the top block still rewinds
+  StackAllocator<int, 8> allocator;
+  int* a = allocator.allocate(2);
+  int* b = allocator.allocate(2);
+  allocator.deallocate(a, 2);
+  assert(allocator.allocate(2) == b + 2);
+  allocator.deallocate(b + 2, 2);
+  assert(allocator.allocate(2) == b + 2);
+
+  std::cout << "LIFO deallocation reuses the top of the stack\n";
+}
 
-  std::cout << "---------------\n";
+// Test function for marker()/rollback() and the StackScope guard
+void test_stack_scope() {
+  StackAllocator<int, 64> allocator;
+  int* kept = allocator.allocate(4);
+
+  auto marker = allocator.marker();
+  allocator.allocate(10);
+  allocator.allocate(10);
+  allocator.rollback(marker);
+  assert(allocator.allocate(4) == kept + 4);
+
+  // Scratch space for one "request" after another in the same arena
+  auto before = allocator.marker();
+  for (int request = 0; request < 1'000; ++request) {
+    StackScope<StackAllocator<int, 64>> scope(allocator);
+    int* scratch = allocator.allocate(40);
+    scratch[39] = request;
+  }
+  assert(allocator.marker() == before);
+
+  std::cout << "Stack scopes free their allocations on exit\n";
+}
 
-  const int num_elements = 100'000;
-  std::cout << "Benchmarking std::forward_list with std::allocator:" << '\n';
-  std::forward_list<int, std::allocator<int>> forward_list_std_alloc;
-  benchmark_list(forward_list_std_alloc, num_elements);
+// Test function for a StackArena shared by several containers through
+// ArenaAllocator handles
+void test_shared_arena() {
+  InlineStackArena<4096> arena;
+  ArenaAllocator<int> alloc(arena);
+
+  // Handles rebind to any type and stay on the same arena
+  ArenaAllocator<double> rebound(alloc);
+  InlineStackArena<64> other_arena;
+  assert(rebound == alloc);
+  assert(ArenaAllocator<int>(other_arena) != alloc);
+
+  LinkedList<int, ArenaAllocator<int>> list1({1, 2, 3}, alloc);
+  LinkedList<int, ArenaAllocator<int>> list2 = list1;  // Same arena
+  std::forward_list<int, ArenaAllocator<int>> std_list({4, 5}, alloc);
+  std::vector<int, ArenaAllocator<int>> vector(alloc);
+  vector.reserve(16);
+  assert(list2.get_allocator() == list1.get_allocator());
+  assert(compare_lists(list1, list2));
+
+  // 8 nodes of an int and a link each, plus the vector's 16 ints
+  size_t used = arena.used();
+  assert(used > 0 && used <= 8 * 2 * sizeof(void*) + 16 * sizeof(int));
+
+  std::cout << "Arena shared by 4 containers, bytes used: " << used << '\n';
+
+  // Everything a scope allocates goes away with it, whichever container
+  {
+    StackScope<StackArena> scope(arena);
+    LinkedList<int, ArenaAllocator<int>> scratch(alloc);
+    for (int i = 0; i < 100; ++i) {
+      scratch.push_front(i);
+    }
+  }
+  assert(arena.used() == used);
+
+  // A full arena reports bad_alloc
+  bool threw = false;
+  try {
+    std::vector<int, ArenaAllocator<int>> big(4096, 0, alloc);
+  } catch (const std::bad_alloc&) {
+    threw = true;
+  }
+  assert(threw);
+}
 
-  std::cout << "Benchmarking LinkedList with std::allocator:" << '\n';
-  LinkedList<int, std::allocator<int>> linked_list;
-  benchmark_list(linked_list, num_elements);
+// Upstream resource that counts the blocks it hands out
+class CountingResource : public std::pmr::memory_resource {
+ public:
+  size_t live = 0;          // Blocks not yet returned
+  std::vector<size_t> sizes;  // Sizes of all blocks handed out
+
+ private:
+  void* do_allocate(size_t bytes, size_t alignment) override {
+    ++live;
+    sizes.push_back(bytes);
+    return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+  }
 
-  std::cout << "Benchmarking std::forward_list with StackAllocator:" << '\n';
-  std::forward_list<int, StackAllocator<int, 100'010>> forward_list_cus_alloc;
-  benchmark_list(forward_list_cus_alloc, num_elements);
+  void do_deallocate(void* p, size_t bytes, size_t alignment) override {
+    --live;
+    std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+  }
 
-  std::cout << "Benchmarking LinkedList with StackAllocator:" << '\n';
-  LinkedList<int, StackAllocator<int, 100'010>> linked_list_cus_alloc;
-  benchmark_list(linked_list_cus_alloc, num_elements);
+  bool do_is_equal(const memory_resource& other) const noexcept override {
+    return this == &other;
+  }
+};
+
+// Test function for an arena that overflows into chained upstream blocks
+void test_arena_overflow() {
+  CountingResource upstream;
+  {
+    InlineStackArena<256> arena(&upstream);
+    LinkedList<int, ArenaAllocator<int>> list(ArenaAllocator<int>{arena});
+
+    // The first few nodes stay in the inline buffer
+    for (int i = 0; i < 8; ++i) {
+      list.push_front(i);
+    }
+    assert(upstream.sizes.empty());
+
+    for (int i = 0; i < 10'000; ++i) {
+      list.push_front(i);
+    }
+    assert(*list.begin() == 9'999);
+
+    // Blocks double in size, so few are needed
+    assert(upstream.live >= 2 && upstream.live <= 8);
+    for (size_t i = 1; i < upstream.sizes.size(); ++i) {
+      assert(upstream.sizes[i] == 2 * upstream.sizes[i - 1]);
+    }
+    std::cout << "Arena chained " << upstream.live << " blocks for "
+              << arena.used() << " bytes\n";
+
+    // A rollback releases the blocks chained since its marker
+    auto marker = arena.marker();
+    ArenaAllocator<char> bytes(arena);
+    std::vector<char, ArenaAllocator<char>> big(1 << 20, 0, bytes);
+    size_t chained = upstream.live;
+    big.clear();
+    arena.rollback(marker);
+    assert(upstream.live == chained - 1);
+
+    // Requests larger than the next block get a block of their own
+    std::vector<char, ArenaAllocator<char>> huge(bytes);
+    huge.reserve(8 << 20);
+    assert(upstream.sizes.back() >= (8u << 20));
+  }
+  assert(upstream.live == 0);  // Destruction returns everything
+
+  InlineStackArena<64> arena(&upstream);
+  arena.allocate(1000, 8);
+  arena.reset();
+  assert(upstream.live == 0 && arena.capacity() == 64);
+
+  // Growth starts over after a reset or rollback, so a reused arena chains
+  // blocks of the same size every cycle
+  upstream.sizes.clear();
+  auto start = arena.marker();
+  for (int cycle = 0; cycle < 64; ++cycle) {
+    arena.allocate(2000, 8);
+    if (cycle % 2 == 0) {
+      arena.reset();
+    } else {
+      arena.rollback(start);
+    }
+  }
+  assert(upstream.live == 0 && upstream.sizes.size() == 64);
+  for (size_t size : upstream.sizes) {
+    assert(size == upstream.sizes.front());
+  }
+}
+
+// Test function for the memory resources: std::pmr containers and a
+// LinkedList with a polymorphic_allocator on an arena that chains upstream
+// blocks, and on the c_malloc heap
+void test_pmr_resources() {
+  using StringAlloc = std::pmr::polymorphic_allocator<std::pmr::string>;
+  auto text = [](int i) {
+    return std::pmr::string(std::to_string(i).c_str()) +
+           " is longer than any small string buffer";
+  };
+  CountingResource upstream;
+  {
+    InlineStackArena<1024> arena(&upstream);
+    ArenaResource resource(arena);
+    assert(resource.is_equal(ArenaResource(arena)));
+
+    std::pmr::vector<int> vector(&resource);
+    for (int i = 0; i < 1000; ++i) {
+      vector.push_back(i);
+    }
+    assert(upstream.live > 0);  // 4000 bytes do not fit the buffer
+
+    // Elements that take an allocator get the container's resource
+    std::pmr::unordered_map<int, std::pmr::string> map(&resource);
+    for (int i = 0; i < 100; ++i) {
+      map.emplace(i, text(i));
+    }
+    assert(map.at(42) == text(42));
+    assert(map.at(42).get_allocator().resource() == &resource);
+
+    LinkedList<std::pmr::string, StringAlloc> list{StringAlloc(&resource)};
+    for (int i = 0; i < 100; ++i) {
+      list.push_front(text(i));
+    }
+    assert(*list.begin() == text(99));
+    assert((*list.begin()).get_allocator().resource() == &resource);
+
+    // A polymorphic_allocator stays with its list: copies start on the
+    // default resource, and assignments move elements between resources
+    LinkedList<std::pmr::string, StringAlloc> copy = list;
+    assert(copy.get_allocator().resource() == std::pmr::get_default_resource());
+    assert(compare_lists(copy, list));
+    copy = std::move(list);
+    assert(copy.get_allocator().resource() == std::pmr::get_default_resource());
+    assert((*copy.begin()).get_allocator().resource() ==
+           std::pmr::get_default_resource());
+    list = copy;
+    assert(list.get_allocator().resource() == &resource);
+    assert(compare_lists(copy, list));
+
+    UnrolledLinkedList<int, std::pmr::polymorphic_allocator<int>> unrolled(
+        {1, 2, 3}, std::pmr::polymorphic_allocator<int>(&resource));
+    UnrolledLinkedList<int, std::pmr::polymorphic_allocator<int>> assigned;
+    assigned = unrolled;
+    assert(assigned.get_allocator().resource() ==
+           std::pmr::get_default_resource());
+    assert(compare_lists(assigned, unrolled));
+
+    std::cout << "pmr containers on an arena chained " << upstream.live
+              << " blocks for " << arena.used() << " bytes\n";
+  }
+  assert(upstream.live == 0);
+
+  std::pmr::memory_resource* heap = cmalloc_resource();
+  assert(heap->is_equal(CMallocResource()));
+  assert(!heap->is_equal(*std::pmr::new_delete_resource()));
+
+  CMallocStats before, after;
+  c_malloc_stats(&before);
+  {
+    LinkedList<int, std::pmr::polymorphic_allocator<int>> list{
+        std::pmr::polymorphic_allocator<int>(heap)};
+    std::pmr::unordered_map<int, int> map(heap);
+    for (int i = 0; i < 1000; ++i) {
+      list.push_front(i);
+      map[i] = i;
+    }
+    assert(list.size() == 1000 && map.size() == 1000);
+
+    void* aligned = heap->allocate(100, 256);
+    assert(reinterpret_cast<uintptr_t>(aligned) % 256 == 0);
+    heap->deallocate(aligned, 100, 256);
+  }
+  c_malloc_stats(&after);
+  assert(after.allocs - before.allocs >= 2001);
+  assert(after.allocs - before.allocs == after.frees - before.frees);
+
+  std::cout << "pmr containers on the c_malloc heap made "
+            << after.allocs - before.allocs << " allocations\n";
+}
+
+// Test function for PoolAllocator under steady-state churn: a queue that
+// keeps appending and popping reuses freed slots instead of growing
+void test_pool_allocator() {
+  PoolAllocator<int> alloc;
+
+  // Copies and rebinds share one pool
+  PoolAllocator<double> rebound(alloc);
+  assert(rebound == alloc);
+  assert(PoolAllocator<int>() != alloc);
+
+  // A freed slot is the next one handed out
+  int* a = alloc.allocate(1);
+  alloc.deallocate(a, 1);
+  assert(alloc.allocate(1) == a);
+  alloc.deallocate(a, 1);
+
+  std::forward_list<int, PoolAllocator<int>> queue(alloc);
+  auto tail = queue.before_begin();
+  for (int i = 0; i < 1'000; ++i) {
+    tail = queue.insert_after(tail, i);
+  }
+  size_t slab_bytes = alloc.pool()->slab_bytes();
+
+  for (int i = 1'000; i < 1'000'000; ++i) {
+    tail = queue.insert_after(tail, i);
+    queue.pop_front();
+  }
+  assert(queue.front() == 999'000);
+  assert(alloc.pool()->slab_bytes() == slab_bytes);
+
+  // A moved-from list keeps a pool of its own to allocate from
+  std::forward_list<int, PoolAllocator<int>> moved(std::move(queue));
+  assert(moved.front() == 999'000);
+  queue.push_front(-1);
+  assert(queue.front() == -1 && queue.get_allocator() == alloc);
+
+  LinkedList<int, PoolAllocator<int>> list1({1, 2, 3}, alloc);
+  LinkedList<int, PoolAllocator<int>> list2 = list1;  // Same pool
+  assert(list2.get_allocator() == alloc);
+  assert(compare_lists(list1, list2));
+
+  std::cout << "Pool churned 1M nodes in " << slab_bytes
+            << " bytes of slabs\n";
+}
+
+// Test function for ConcurrentPoolAllocator: every thread builds lists and
+// hands them to the next thread, which checks and frees them, so nodes are
+// allocated and freed on different threads throughout
+void test_concurrent_pool() {
+  using List = LinkedList<int, ConcurrentPoolAllocator<int>>;
+  constexpr int THREADS = 4;
+  constexpr int LISTS = 2'000;
+  constexpr int NODES = 100;
+
+  // Define a structure for the lists waiting for one thread
+  struct Mailbox {
+    std::mutex lock;
+    std::vector<List*> lists;
+  };
+  Mailbox mailboxes[THREADS];
+
+  auto worker = [&](int id) {
+    Mailbox& next = mailboxes[(id + 1) % THREADS];
+    Mailbox& mine = mailboxes[id];
+    int received = 0;
+
+    for (int i = 0; i < LISTS || received < LISTS; ++i) {
+      if (i < LISTS) {
+        List* list = new List;
+        for (int n = 0; n < NODES; ++n) {
+          list->push_front(id * NODES + n);
+        }
+        std::lock_guard<std::mutex> guard(next.lock);
+        next.lists.push_back(list);
+      }
+
+      std::vector<List*> lists;
+      {
+        std::lock_guard<std::mutex> guard(mine.lock);
+        lists.swap(mine.lists);
+      }
+      int sender = (id + THREADS - 1) % THREADS;
+      for (List* list : lists) {
+        int expected = sender * NODES + NODES - 1;
+        for (int value : *list) {
+          assert(value == expected--);
+        }
+        delete list;
+      }
+      received += static_cast<int>(lists.size());
+      if (lists.empty() && i >= LISTS) {
+        std::this_thread::yield();
+      }
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (int id = 0; id < THREADS; ++id) {
+    threads.emplace_back(worker, id);
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+
+  // Slabs only cover the lists that were in flight at the same time
+  size_t slab_bytes = ConcurrentPoolAllocator<List::Node>::slab_bytes();
+  assert(slab_bytes > 0);
+
+  std::cout << "Concurrent pool passed " << THREADS * LISTS
+            << " lists between threads in " << slab_bytes
+            << " bytes of slabs\n";
+}
+
+// Element type that counts its copies and moves
+struct Tracked {
+  static int copies;
+  static int moves;
+  int value;
+
+  explicit Tracked(int v) : value(v) {}
+  Tracked(const Tracked& other) : value(other.value) { ++copies; }
+  Tracked(Tracked&& other) noexcept : value(other.value) { ++moves; }
+};
+int Tracked::copies = 0;
+int Tracked::moves = 0;
+
+// Function to build a list in a function and return it by value
+LinkedList<int, std::allocator<int>> make_list(int n) {
+  LinkedList<int, std::allocator<int>> list;
+  for (int i = 0; i < n; ++i) {
+    list.push_back(i);
+  }
+  return list;
+}
+
+// Test function for move construction and assignment, emplace and the tail
+// pointer
+void test_move_semantics() {
+  // Emplace constructs in place; rvalue pushes move
+  LinkedList<Tracked, std::allocator<Tracked>> tracked;
+  tracked.emplace_back(1);
+  tracked.emplace_front(0);
+  tracked.push_back(Tracked(2));
+  assert(Tracked::copies == 0 && Tracked::moves == 1);
+
+  // Move-only elements
+  LinkedList<std::unique_ptr<int>, std::allocator<int>> owners;
+  owners.push_back(std::make_unique<int>(1));
+  owners.emplace_back(new int(2));
+  assert(**owners.begin() == 1);
+
+  // Moving a list hands over its nodes without touching them
+  LinkedList<int, std::allocator<int>> list1 = make_list(100'000);
+  int* first = &*list1.begin();
+  LinkedList<int, std::allocator<int>> list2(std::move(list1));
+  assert(&*list2.begin() == first && list1.begin() == list1.end());
+  list1 = std::move(list2);
+  assert(&*list1.begin() == first && list2.begin() == list2.end());
+
+  // The tail pointer survives moves and pops down to an empty list
+  list2.push_back(1);
+  list2.pop_front();
+  list2.push_back(2);
+  list2.push_front(1);
+  list2.push_back(3);
+  assert(compare_lists(list2, LinkedList<int, std::allocator<int>>{1, 2, 3}));
+
+  // A StackAllocator only equals itself, so its elements are moved into the
+  // destination's own buffer
+  LinkedList<int, StackAllocator<int, 16>> stack1{1, 2, 3};
+  LinkedList<int, StackAllocator<int, 16>> stack2(std::move(stack1));
+  assert(stack1.begin() == stack1.end());
+  stack1 = LinkedList<int, StackAllocator<int, 16>>{4, 5};
+  stack1.push_back(6);
+  assert(compare_lists(stack2, LinkedList<int, StackAllocator<int, 16>>{
+                                   1, 2, 3}));
+
+  // The destination's buffer starts empty, so a list filling more than half
+  // of it still moves, and the source keeps its own buffer
+  LinkedList<int, std::allocator<int>> sixty = make_list(60);
+  LinkedList<int, StackAllocator<int, 100>> full1(sixty.begin(), sixty.end());
+  LinkedList<int, StackAllocator<int, 100>> full2(std::move(full1));
+  assert(compare_lists(full2, sixty));
+  full1.push_front(1);
+  assert(compare_lists(full1, LinkedList<int, std::allocator<int>>{1}));
+
+  // ArenaAllocator propagates on move assignment, so nodes change hands
+  InlineStackArena<1024> arena1;
+  InlineStackArena<1024> arena2;
+  LinkedList<int, ArenaAllocator<int>> arena_list1(
+      {1, 2}, ArenaAllocator<int>(arena1));
+  LinkedList<int, ArenaAllocator<int>> arena_list2(ArenaAllocator<int>{arena2});
+  arena_list2 = std::move(arena_list1);
+  assert(arena_list2.get_allocator().arena() == &arena1);
+  arena_list2.push_back(3);
+  assert(*arena_list2.begin() == 1);
+
+  std::cout << "Lists move in O(1) and build in place\n";
+}
+
+// Test function for UnrolledLinkedList against std::forward_list
+void test_unrolled_list() {
+  using List = UnrolledLinkedList<int, std::allocator<int>>;
+  static_assert(sizeof(List::Node) <= 128, "Nodes must fit two cache lines");
+
+  // Mixed pushes at both ends and pops, checked element by element
+  List list;
+  std::forward_list<int> expected;
+  auto expected_tail = expected.before_begin();
+  for (int i = 0; i < 1'000; ++i) {
+    list.push_back(i);
+    expected_tail = expected.insert_after(expected_tail, i);
+    if (i % 3 == 0) {
+      list.push_front(-i);
+      expected.push_front(-i);
+    }
+    if (i % 5 == 0) {
+      list.pop_front();
+      expected.pop_front();
+    }
+  }
+  assert(compare_lists(list, expected));
+
+  // Spans cover every element once, in order
+  long sum = 0;
+  size_t spans = 0;
+  list.for_each_span([&](const int* first, const int* last) {
+    for (; first != last; ++first) {
+      sum += *first;
+    }
+    ++spans;
+  });
+  long expected_sum = 0;
+  size_t count = 0;
+  for (int value : expected) {
+    expected_sum += value;
+    ++count;
+  }
+  assert(sum == expected_sum);
+  assert(spans <= count / List::NODE_ELEMENTS + 3);
+
+  // Copies, moves and non-trivial elements with a StackAllocator
+  UnrolledLinkedList<std::string, StackAllocator<std::string, 16>> strings{
+      "a", "b", "c", "d", "e"};
+  auto copy = strings;
+  auto moved = std::move(strings);
+  moved.pop_front();
+  assert(*copy.begin() == "a" && *moved.begin() == "b");
+  assert(strings.begin() == strings.end());
+
+  // Pool nodes are recycled as the list drains
+  UnrolledLinkedList<int, PoolAllocator<int>> pooled;
+  for (int i = 0; i < 100'000; ++i) {
+    pooled.push_front(i);
+  }
+  while (pooled.begin() != pooled.end()) {
+    pooled.pop_front();
+  }
+  size_t slab_bytes = pooled.get_allocator().pool()->slab_bytes();
+  for (int i = 0; i < 100'000; ++i) {
+    pooled.push_back(i);
+  }
+  assert(pooled.get_allocator().pool()->slab_bytes() == slab_bytes);
+
+  std::cout << "Unrolled list holds " << List::NODE_ELEMENTS
+            << " ints per node, " << spans << " spans for " << count
+            << " elements\n";
+}
+
+// Function to check that the nodes of a list are contiguous and in list
+// order
+template <typename List>
+bool contiguous(List& list) {
+  char* previous = reinterpret_cast<char*>(&*list.begin());
+  for (auto it = ++list.begin(); it != list.end(); ++it) {
+    char* current = reinterpret_cast<char*>(&*it);
+    if (current - previous != sizeof(typename List::Node)) {
+      return false;
+    }
+    previous = current;
+  }
+  return true;
+}
+
+// Test function for range construction, insert_after() and assign(), which
+// take all nodes of a range in one allocation when the allocator allows it
+void test_bulk_insert() {
+  std::vector<int> values;
+  for (int i = 0; i < 1'000; ++i) {
+    values.push_back(i);
+  }
+
+  LinkedList<int, StackAllocator<int, 4096>> stack_list(values.begin(),
+                                                        values.end());
+  assert(contiguous(stack_list));
+  LinkedList<int, StackAllocator<int, 4096>> stack_copy = stack_list;
+  assert(contiguous(stack_copy) && compare_lists(stack_copy, values));
+
+  LinkedList<int, PoolAllocator<int>> pool_list(values.begin(), values.end());
+  assert(contiguous(pool_list) && compare_lists(pool_list, values));
+
+  // Inserting in the middle, at the front and at the end keeps the tail
+  LinkedList<int, std::allocator<int>> list{1, 5};
+  int middle[] = {2, 3, 4};
+  auto last = list.insert_after(list.begin(), middle, middle + 3);
+  assert(*last == 4);
+  list.insert_after(list.before_begin(), middle, middle);  // Empty range
+  int front[] = {-1, 0};
+  list.insert_after(list.before_begin(), front, front + 2);
+  auto end = list.begin();
+  for (int i = 0; i < 6; ++i) {
+    ++end;
+  }
+  int back[] = {6, 7};
+  list.insert_after(end, back, back + 2);
+  list.push_back(8);
+  assert(compare_lists(list, LinkedList<int, std::allocator<int>>{
+                                 -1, 0, 1, 2, 3, 4, 5, 6, 7, 8}));
+  assert(list.size() == 10 && stack_copy.size() == values.size());
+
+  // Single-pass input ranges still work, one node at a time
+  std::istringstream input("10 20 30");
+  list.assign(std::istream_iterator<int>(input), std::istream_iterator<int>());
+  list.push_back(40);
+  assert(compare_lists(list, LinkedList<int, std::allocator<int>>{
+                                 10, 20, 30, 40}));
+
+  // A failed element leaves the list as it was and frees the block
+  LinkedList<Tracked, PoolAllocator<Tracked>> tracked;
+  tracked.emplace_back(1);
+  struct Throwing {
+    int value;
+    operator Tracked() const {
+      if (value == 3) {
+        throw std::runtime_error("element");
+      }
+      return Tracked(value);
+    }
+  };
+  Throwing throwing[] = {{2}, {3}};
+  bool threw = false;
+  try {
+    tracked.insert_after(tracked.begin(), throwing, throwing + 2);
+  } catch (const std::runtime_error&) {
+    threw = true;
+  }
+  assert(threw && (*tracked.begin()).value == 1 && tracked.size() == 1);
+  assert(++tracked.begin() == tracked.end());
+
+  std::cout << "Ranges of " << values.size()
+            << " nodes take one contiguous allocation\n";
+}
+
+// Test function for sort(), which relinks nodes, and compact(), which moves
+// the elements into one contiguous block in list order
+void test_compact_and_sort() {
+  // Sorting by tens keeps equal keys in their original order and neither
+  // copies nor moves an element
+  LinkedList<Tracked, PoolAllocator<Tracked>> tracked;
+  for (int i = 0; i < 500; ++i) {
+    tracked.emplace_back(i * 37 % 500);
+  }
+  int copies = Tracked::copies;
+  int moves = Tracked::moves;
+  tracked.sort([](const Tracked& a, const Tracked& b) {
+    return a.value / 10 < b.value / 10;
+  });
+  assert(Tracked::copies == copies && Tracked::moves == moves);
+  auto position = [](int value) { return value * 473 % 500; };  // 1 / 37
+  const Tracked* previous = nullptr;
+  for (const Tracked& t : tracked) {
+    if (previous != nullptr) {
+      int a = previous->value / 10;
+      int b = t.value / 10;
+      assert(a < b ||
+             (a == b && position(previous->value) < position(t.value)));
+    }
+    previous = &t;
+  }
+  assert(tracked.size() == 500 && !contiguous(tracked));
+
+  // The tail follows the sort, so appending still goes to the end
+  tracked.emplace_back(-1);
+  int last = 0;
+  for (const Tracked& t : tracked) {
+    last = t.value;
+  }
+  assert(last == -1);
+
+  // Compacting moves each element once, into contiguous nodes
+  tracked.compact();
+  assert(contiguous(tracked) && tracked.size() == 501);
+  assert(Tracked::copies == copies && Tracked::moves == moves + 501);
+  tracked.emplace_back(-2);
+  assert(tracked.size() == 502);
+
+  // Without bulk allocation the nodes are fresh but allocated one by one
+  LinkedList<int, std::allocator<int>> list{5, 3, 9, 1, 3, 7};
+  list.sort();
+  assert(compare_lists(list,
+                       LinkedList<int, std::allocator<int>>{1, 3, 3, 5, 7, 9}));
+  list.sort(std::greater<>());
+  list.compact();
+  list.push_back(0);
+  assert(compare_lists(list, LinkedList<int, std::allocator<int>>{
+                                 9, 7, 5, 3, 3, 1, 0}));
+
+  // StackAllocator lists compact behind their old nodes
+  LinkedList<int, StackAllocator<int, 4096>> stack_list;
+  for (int i = 0; i < 100; ++i) {
+    stack_list.push_front(i % 7);
+  }
+  stack_list.sort();
+  stack_list.compact();
+  assert(contiguous(stack_list) && stack_list.size() == 100);
+  int previous_value = -1;
+  for (int v : stack_list) {
+    assert(v >= previous_value);
+    previous_value = v;
+  }
+
+  LinkedList<int, std::allocator<int>> empty;
+  empty.sort();
+  empty.compact();
+  assert(empty.size() == 0 && empty.begin() == empty.end());
+
+  std::cout << "Sorted " << tracked.size() - 2
+            << " elements without moving them and compacted them\n";
+}
+
+// Function to push PER_PRODUCER tagged values from several threads into one
+// queue and check that the consumer sees each exactly once, in per-producer
+// order
+template <typename Alloc>
+void stress_mpsc_queue(const char* name) {
+  constexpr uint64_t PRODUCERS = 4;
+  constexpr uint64_t PER_PRODUCER = 200'000;
+  MpscQueue<uint64_t, Alloc> queue;
+
+  std::vector<std::thread> producers;
+  for (uint64_t id = 0; id < PRODUCERS; ++id) {
+    producers.emplace_back([&queue, id] {
+      for (uint64_t seq = 0; seq < PER_PRODUCER; ++seq) {
+        queue.push(id << 32 | seq);
+      }
+    });
+  }
+
+  // The next sequence number expected from each producer
+  std::vector<uint64_t> expected(PRODUCERS, 0);
+  uint64_t received = 0;
+  while (received < PRODUCERS * PER_PRODUCER) {
+    uint64_t value;
+    if (!queue.try_pop(value)) {
+      std::this_thread::yield();
+      continue;
+    }
+    uint64_t id = value >> 32;
+    assert(id < PRODUCERS && (value & 0xFFFFFFFF) == expected[id]);
+    ++expected[id];
+    ++received;
+  }
+  for (std::thread& producer : producers) {
+    producer.join();
+  }
+  assert(queue.empty());
+
+  std::cout << "MPSC queue with " << name << " delivered " << received
+            << " values from " << PRODUCERS << " producers once each\n";
+}
+
+// Test function for MpscQueue
+void test_mpsc_queue() {
+  // Single-threaded: FIFO order and non-trivial elements
+  MpscQueue<std::string> strings;
+  strings.push("first");
+  strings.emplace(3, 'x');
+  std::string out;
+  assert(strings.try_pop(out) && out == "first");
+  assert(strings.try_pop(out) && out == "xxx");
+  assert(!strings.try_pop(out) && strings.empty());
+  strings.push("left behind");  // Freed by the destructor
+
+  stress_mpsc_queue<std::allocator<uint64_t>>("std::allocator");
+  stress_mpsc_queue<ConcurrentPoolAllocator<uint64_t>>("pool");
+}
+
+int main() {
+  std::cout << "Testing StackAllocator..." << '\n';
+  test_stack_allocator();
+
+  std::cout << "\nTesting LinkedList with StackAllocator..." << '\n';
+  test_linked_list();
 
   test_copy_constructor_and_assignment_operator();
   test_compare_with_std_forward_list();
@@ -383,4 +1121,28 @@ int main() {
   std::cout << "Testing LinkedList with custom allocator...\n";
   test_linked_list_with_custom_allocator();
 
+  std::cout << "\nTesting LinkedList moves...\n";
+  test_move_semantics();
+  test_bulk_insert();
+  test_compact_and_sort();
+
+  std::cout << "\nTesting UnrolledLinkedList...\n";
+  test_unrolled_list();
+
+  std::cout << "\nTesting StackAllocator scopes...\n";
+  test_stack_allocator_lifo();
+  test_stack_scope();
+
+  std::cout << "\nTesting StackArena...\n";
+  test_shared_arena();
+  test_arena_overflow();
+  test_pmr_resources();
+
+  std::cout << "\nTesting PoolAllocator...\n";
+  test_pool_allocator();
+  test_concurrent_pool();
+
+  std::cout << "\nTesting MpscQueue...\n";
+  test_mpsc_queue();
+
 }
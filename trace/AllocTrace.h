@@ -0,0 +1,36 @@
+#ifndef ALLOC_TRACE_H
+#define ALLOC_TRACE_H
+
+#include <stdint.h>
+
+// Binary allocation trace, as written by the TraceRecorder preload library
+// and read by the trace_replay driver. A file is one AllocTraceHeader
+// followed by fixed-size records in the order the calls completed.
+
+#define ALLOC_TRACE_MAGIC 0x43525441u  // "ATRC" in little endian
+#define ALLOC_TRACE_VERSION 1
+
+// Operations. Every allocation gets a new object id; realloc keeps the id of
+// the object it resizes, and free retires it.
+enum {
+  TRACE_MALLOC = 1,   // malloc, calloc and the memalign family
+  TRACE_FREE = 2,     // free of a traced pointer
+  TRACE_REALLOC = 3,  // realloc of a traced pointer to a non-zero size
+};
+
+typedef struct {
+  uint32_t magic;        // ALLOC_TRACE_MAGIC
+  uint16_t version;      // ALLOC_TRACE_VERSION
+  uint16_t record_size;  // sizeof(AllocTraceRecord)
+} AllocTraceHeader;
+
+typedef struct {
+  uint64_t timestamp;  // Nanoseconds since the recorder started
+  uint64_t size;       // Requested size, or the new size for realloc
+  uint32_t object;     // Id of the allocation the call works on
+  uint16_t thread;     // Recorder-assigned index of the calling thread
+  uint8_t op;          // TRACE_MALLOC, TRACE_FREE or TRACE_REALLOC
+  uint8_t reserved;
+} AllocTraceRecord;
+
+#endif  // ALLOC_TRACE_H
@@ -0,0 +1,384 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "AllocTrace.h"
+
+// Allocation trace recorder, built as a shared library and loaded with
+// LD_PRELOAD. It wraps the C library allocator and appends one
+// AllocTraceRecord per call to <ALLOC_TRACE>.<pid>.trace (ALLOC_TRACE
+// defaults to "alloc"), so every process of a pipeline gets its own file.
+//
+// The real work is done by glibc's __libc_* entry points, so there is no
+// dlsym lookup to bootstrap. The recorder itself never allocates: its
+// pointer table lives in mmap'd memory and records go out through write().
+// A single lock puts the calls of all threads in one order that a replay can
+// follow; frees are recorded before the memory is released, so a reused
+// address can never show up ahead of the free of its previous owner.
+
+#define TRACE_API __attribute__((visibility("default")))
+#define BUFFER_RECORDS 4096       // Records collected before a write()
+#define TABLE_INITIAL (1 << 16)   // Initial slots of the pointer table
+
+extern void* __libc_malloc(size_t size);
+extern void __libc_free(void* ptr);
+extern void* __libc_calloc(size_t count, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+extern void* __libc_memalign(size_t alignment, size_t size);
+extern void* __libc_valloc(size_t size);
+extern void* __libc_pvalloc(size_t size);
+
+// Define a structure for the pointer table: live traced pointers and their
+// object ids, open addressing with linear probing
+typedef struct Slot {
+  uintptr_t ptr;    // 0 marks an empty slot
+  uint32_t object;  // Id the allocation was recorded with
+} Slot;
+
+static int TRACING = 0;        // Set once the output file is open
+static int TRACE_FD = -1;      // Output file
+static uint64_t START_NS = 0;  // Clock reading the timestamps start from
+static uint32_t NEXT_OBJECT = 0;
+static uint16_t NEXT_THREAD = 0;
+
+static Slot* TABLE = NULL;     // Pointer table
+static size_t TABLE_SIZE = 0;  // Number of slots, a power of two
+static size_t TABLE_USED = 0;  // Number of occupied slots
+
+static AllocTraceRecord BUFFER[BUFFER_RECORDS];
+static size_t BUFFERED = 0;
+
+// Protects everything above once tracing has started
+static pthread_mutex_t TRACE_LOCK = PTHREAD_MUTEX_INITIALIZER;
+
+static _Thread_local uint16_t THREAD
+    __attribute__((tls_model("initial-exec"))) = 0;
+
+// Function to read a monotonic clock in nanoseconds
+static uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+// Function to check whether calls are being recorded
+static inline int tracing() {
+  return __builtin_expect(__atomic_load_n(&TRACING, __ATOMIC_RELAXED), 1);
+}
+
+// Function to write out the buffered records
+static void flush_buffer() {
+  const uint8_t* data = (const uint8_t*)BUFFER;
+  size_t left = BUFFERED * sizeof(AllocTraceRecord);
+
+  while (left > 0) {
+    ssize_t n = write(TRACE_FD, data, left);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      break;  // Nothing sensible to do about a full disk from inside malloc
+    }
+    data += n;
+    left -= (size_t)n;
+  }
+  BUFFERED = 0;
+}
+
+// Function to append a record. The caller must hold TRACE_LOCK; calls that
+// race with the end of the trace are dropped.
+static void append(uint8_t op, uint32_t object, uint64_t size) {
+  if (!__atomic_load_n(&TRACING, __ATOMIC_RELAXED)) {
+    return;
+  }
+  if (THREAD == 0) {
+    THREAD = ++NEXT_THREAD;
+  }
+
+  AllocTraceRecord* r = &BUFFER[BUFFERED++];
+  r->timestamp = now_ns() - START_NS;
+  r->size = size;
+  r->object = object;
+  r->thread = THREAD;
+  r->op = op;
+  r->reserved = 0;
+
+  if (BUFFERED == BUFFER_RECORDS) {
+    flush_buffer();
+  }
+}
+
+// Function to spread pointers over the table; allocations are 16-byte
+// aligned, so the low bits carry no information
+static inline size_t slot_of(uintptr_t ptr) {
+  return (size_t)(((ptr >> 4) * 0x9E3779B97F4A7C15ull) >> 32) &
+         (TABLE_SIZE - 1);
+}
+
+// Function to map a zeroed table of 'size' slots
+static Slot* table_map(size_t size) {
+  void* p = mmap(NULL, size * sizeof(Slot), PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  return p != MAP_FAILED ? p : NULL;
+}
+
+// Function to add a pointer to the table, doubling it at half load.
+// The caller must hold TRACE_LOCK.
+static void table_insert(uintptr_t ptr, uint32_t object) {
+  if (2 * (TABLE_USED + 1) > TABLE_SIZE) {
+    Slot* old = TABLE;
+    size_t old_size = TABLE_SIZE;
+    Slot* grown = table_map(old_size * 2);
+    if (grown == NULL) {
+      return;  // The object goes untraced; its free is simply skipped
+    }
+
+    TABLE = grown;
+    TABLE_SIZE = old_size * 2;
+    for (size_t i = 0; i < old_size; ++i) {
+      if (old[i].ptr != 0) {
+        size_t j = slot_of(old[i].ptr);
+        while (TABLE[j].ptr != 0) {
+          j = (j + 1) & (TABLE_SIZE - 1);
+        }
+        TABLE[j] = old[i];
+      }
+    }
+    munmap(old, old_size * sizeof(Slot));
+  }
+
+  size_t i = slot_of(ptr);
+  while (TABLE[i].ptr != 0) {
+    i = (i + 1) & (TABLE_SIZE - 1);
+  }
+  TABLE[i].ptr = ptr;
+  TABLE[i].object = object;
+  ++TABLE_USED;
+}
+
+// Function to take a pointer out of the table, returning its object id
+// through 'object'. Later entries of the probe run are shifted back into the
+// gap, so lookups never need tombstones. Returns 0 for untraced pointers.
+// The caller must hold TRACE_LOCK.
+static int table_remove(uintptr_t ptr, uint32_t* object) {
+  size_t mask = TABLE_SIZE - 1;
+  size_t i = slot_of(ptr);
+
+  while (TABLE[i].ptr != ptr) {
+    if (TABLE[i].ptr == 0) {
+      return 0;
+    }
+    i = (i + 1) & mask;
+  }
+  *object = TABLE[i].object;
+
+  for (size_t j = (i + 1) & mask; TABLE[j].ptr != 0; j = (j + 1) & mask) {
+    size_t home = slot_of(TABLE[j].ptr);
+    if (((j - home) & mask) >= ((j - i) & mask)) {
+      TABLE[i] = TABLE[j];
+      i = j;
+    }
+  }
+  TABLE[i].ptr = 0;
+  --TABLE_USED;
+  return 1;
+}
+
+// Function to record a new allocation
+static void record_malloc(void* p, size_t size) {
+  if (p == NULL || !tracing()) {
+    return;
+  }
+
+  pthread_mutex_lock(&TRACE_LOCK);
+  uint32_t object = NEXT_OBJECT++;
+  table_insert((uintptr_t)p, object);
+  append(TRACE_MALLOC, object, size);
+  pthread_mutex_unlock(&TRACE_LOCK);
+}
+
+// Function to record a free; must run before the memory is released
+static void record_free(void* p) {
+  if (p == NULL || !tracing()) {
+    return;
+  }
+
+  pthread_mutex_lock(&TRACE_LOCK);
+  uint32_t object;
+  if (table_remove((uintptr_t)p, &object)) {
+    append(TRACE_FREE, object, 0);
+  }
+  pthread_mutex_unlock(&TRACE_LOCK);
+}
+
+TRACE_API void* malloc(size_t size) {
+  void* p = __libc_malloc(size);
+  record_malloc(p, size);
+  return p;
+}
+
+TRACE_API void free(void* ptr) {
+  record_free(ptr);
+  __libc_free(ptr);
+}
+
+TRACE_API void* calloc(size_t count, size_t size) {
+  void* p = __libc_calloc(count, size);
+  record_malloc(p, count * size);  // Only non-NULL when it did not overflow
+  return p;
+}
+
+TRACE_API void* realloc(void* ptr, size_t size) {
+  if (ptr == NULL) {
+    return malloc(size);
+  }
+  if (size == 0) {
+    free(ptr);
+    return NULL;
+  }
+  if (!tracing()) {
+    return __libc_realloc(ptr, size);
+  }
+
+  // The old pointer leaves the table first: once realloc returns, another
+  // thread may already have been handed the old address
+  pthread_mutex_lock(&TRACE_LOCK);
+  uint32_t object;
+  int traced = table_remove((uintptr_t)ptr, &object);
+  pthread_mutex_unlock(&TRACE_LOCK);
+
+  void* p = __libc_realloc(ptr, size);
+
+  if (!traced) {
+    record_malloc(p, size);
+    return p;
+  }
+
+  pthread_mutex_lock(&TRACE_LOCK);
+  table_insert((uintptr_t)(p != NULL ? p : ptr), object);
+  if (p != NULL) {
+    append(TRACE_REALLOC, object, size);
+  }
+  pthread_mutex_unlock(&TRACE_LOCK);
+  return p;
+}
+
+TRACE_API void* reallocarray(void* ptr, size_t count, size_t size) {
+  size_t total;
+  if (__builtin_mul_overflow(count, size, &total)) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  return realloc(ptr, total);
+}
+
+TRACE_API int posix_memalign(void** out, size_t alignment, size_t size) {
+  if (alignment == 0 || (alignment & (alignment - 1)) != 0 ||
+      alignment % sizeof(void*) != 0) {
+    return EINVAL;
+  }
+
+  void* p = __libc_memalign(alignment, size);
+  if (p == NULL) {
+    return ENOMEM;
+  }
+  record_malloc(p, size);
+  *out = p;
+  return 0;
+}
+
+TRACE_API void* aligned_alloc(size_t alignment, size_t size) {
+  void* p = __libc_memalign(alignment, size);
+  record_malloc(p, size);
+  return p;
+}
+
+TRACE_API void* memalign(size_t alignment, size_t size) {
+  return aligned_alloc(alignment, size);
+}
+
+TRACE_API void* valloc(size_t size) {
+  void* p = __libc_valloc(size);
+  record_malloc(p, size);
+  return p;
+}
+
+TRACE_API void* pvalloc(size_t size) {
+  size_t page = (size_t)getpagesize();
+  void* p = __libc_pvalloc(size);
+  record_malloc(p, (size + page - 1) & ~(page - 1));  // Whole pages
+  return p;
+}
+
+// Fork handlers: the child inherits a copy of the buffer and the file, so it
+// stops recording rather than writing the parent's records a second time.
+// A child that goes on to exec starts a trace of its own.
+static void fork_prepare() { pthread_mutex_lock(&TRACE_LOCK); }
+static void fork_parent() { pthread_mutex_unlock(&TRACE_LOCK); }
+static void fork_child() {
+  pthread_mutex_unlock(&TRACE_LOCK);
+  __atomic_store_n(&TRACING, 0, __ATOMIC_RELAXED);
+  BUFFERED = 0;
+  close(TRACE_FD);
+  TRACE_FD = -1;
+}
+
+// Function to build "<base>.<pid>.trace" without touching the allocator
+static void trace_path(char* path, size_t capacity, const char* base) {
+  char digits[16];
+  int n = 0;
+  for (pid_t pid = getpid(); pid > 0 || n == 0; pid /= 10) {
+    digits[n++] = (char)('0' + pid % 10);
+  }
+
+  size_t len = strnlen(base, capacity - sizeof(digits) - 8);
+  memcpy(path, base, len);
+  path[len++] = '.';
+  while (n > 0) {
+    path[len++] = digits[--n];
+  }
+  memcpy(path + len, ".trace", sizeof(".trace"));
+}
+
+__attribute__((constructor)) static void trace_start() {
+  const char* base = getenv("ALLOC_TRACE");
+  char path[4096];
+  trace_path(path, sizeof(path), base != NULL ? base : "alloc");
+
+  TABLE = table_map(TABLE_INITIAL);
+  TABLE_SIZE = TABLE_INITIAL;
+  TRACE_FD = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (TABLE == NULL || TRACE_FD < 0) {
+    return;
+  }
+
+  AllocTraceHeader header = {ALLOC_TRACE_MAGIC, ALLOC_TRACE_VERSION,
+                             sizeof(AllocTraceRecord)};
+  if (write(TRACE_FD, &header, sizeof(header)) != sizeof(header)) {
+    return;
+  }
+
+  pthread_atfork(fork_prepare, fork_parent, fork_child);
+  START_NS = now_ns();
+  __atomic_store_n(&TRACING, 1, __ATOMIC_RELAXED);
+}
+
+__attribute__((destructor)) static void trace_stop() {
+  if (!tracing()) {
+    return;
+  }
+
+  pthread_mutex_lock(&TRACE_LOCK);
+  __atomic_store_n(&TRACING, 0, __ATOMIC_RELAXED);
+  flush_buffer();
+  close(TRACE_FD);
+  pthread_mutex_unlock(&TRACE_LOCK);
+}
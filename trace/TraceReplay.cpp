@@ -0,0 +1,293 @@
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "AllocTrace.h"
+#include "MallocImplementation.h"
+#include "StackAllocator.h"
+
+// Replay driver for allocation traces recorded with libtrace_recorder.so.
+// The trace is replayed single-threaded, in the order the recorder saw the
+// calls, once per allocator and each time in a fresh child process, so peak
+// RSS and page faults of one allocator do not leak into the next.
+//
+//   trace_replay <file.trace> [c_malloc] [glibc] [arena]
+
+namespace {
+
+constexpr size_t PAGE_SIZE = 4096;
+
+// Bump arena for the replay: a StackAllocator whose storage is one large
+// block of untouched pages. Frees are no-ops and realloc always copies, so it
+// shows what the trace costs when nothing is ever reused.
+constexpr size_t ARENA_SLOTS = size_t{1} << 26;  // 1 GiB of max_align_t
+using Arena = StackAllocator<std::max_align_t, ARENA_SLOTS>;
+
+Arena* ARENA = nullptr;
+
+// Define a structure for an allocator under test
+struct ReplayAllocator {
+  const char* name;
+  void* (*allocate)(size_t size);
+  void (*release)(void* ptr);
+  void* (*resize)(void* ptr, size_t old_size, size_t size);
+};
+
+void* arena_allocate(size_t size) {
+  constexpr size_t SLOT = sizeof(std::max_align_t);
+  size_t slots = (size + SLOT - 1) / SLOT;
+  return ARENA->allocate(slots != 0 ? slots : 1);
+}
+
+void arena_release(void*) {}
+
+void* arena_resize(void* ptr, size_t old_size, size_t size) {
+  void* p = arena_allocate(size);
+  std::memcpy(p, ptr, std::min(old_size, size));
+  return p;
+}
+
+const ReplayAllocator ALLOCATORS[] = {
+    {"c_malloc", c_malloc, c_free,
+     [](void* ptr, size_t, size_t size) { return c_realloc(ptr, size); }},
+    {"glibc", std::malloc, std::free,
+     [](void* ptr, size_t, size_t size) { return std::realloc(ptr, size); }},
+    {"arena", arena_allocate, arena_release, arena_resize},
+};
+
+// Define a structure for what the trace itself asks for, independent of
+// the allocator
+struct TraceSummary {
+  size_t objects = 0;     // Highest object id plus one
+  size_t threads = 0;     // Distinct recorder thread indices
+  size_t peak_live = 0;   // Largest sum of requested bytes alive at once
+  uint64_t duration = 0;  // Nanoseconds between first and last call
+};
+
+// Function to read a monotonic clock in nanoseconds
+uint64_t now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// Function to load a trace file, returning false when it is not one
+bool load_trace(const char* path, std::vector<AllocTraceRecord>& records) {
+  std::ifstream in(path, std::ios::binary);
+  AllocTraceHeader header;
+  if (!in.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+      header.magic != ALLOC_TRACE_MAGIC ||
+      header.version != ALLOC_TRACE_VERSION ||
+      header.record_size != sizeof(AllocTraceRecord)) {
+    return false;
+  }
+
+  AllocTraceRecord r;
+  while (in.read(reinterpret_cast<char*>(&r), sizeof(r))) {
+    records.push_back(r);
+  }
+  return true;
+}
+
+// Function to work out the object count, threads and peak live bytes
+TraceSummary summarize(const std::vector<AllocTraceRecord>& records) {
+  TraceSummary summary;
+  std::vector<bool> seen_threads(1 << 16);
+  std::vector<uint64_t> sizes;
+  size_t live = 0;
+
+  for (const AllocTraceRecord& r : records) {
+    summary.objects = std::max<size_t>(summary.objects, r.object + size_t{1});
+    if (sizes.size() < summary.objects) {
+      sizes.resize(std::max(summary.objects, 2 * sizes.size()));
+    }
+    if (!seen_threads[r.thread]) {
+      seen_threads[r.thread] = true;
+      ++summary.threads;
+    }
+
+    live -= sizes[r.object];
+    sizes[r.object] = r.op == TRACE_FREE ? 0 : r.size;
+    live += sizes[r.object];
+    summary.peak_live = std::max(summary.peak_live, live);
+  }
+
+  if (!records.empty()) {
+    summary.duration = records.back().timestamp - records.front().timestamp;
+  }
+  return summary;
+}
+
+// Function to read a "Vm...: <n> kB" line of /proc/self/status, in bytes
+size_t proc_status_bytes(const char* field) {
+  std::ifstream status("/proc/self/status");
+  std::string line;
+  size_t length = std::strlen(field);
+
+  while (std::getline(status, line)) {
+    if (line.compare(0, length, field) == 0 && line[length] == ':') {
+      return std::strtoull(line.c_str() + length + 1, nullptr, 10) * 1024;
+    }
+  }
+  return 0;
+}
+
+// Function to write one byte per page, the way a program would fill the
+// memory it asked for, so the pages count towards the RSS
+void touch(void* p, size_t size) {
+  auto* bytes = static_cast<volatile uint8_t*>(p);
+  for (size_t offset = 0; offset < size; offset += PAGE_SIZE) {
+    bytes[offset] = 1;
+  }
+}
+
+// Function to replay the trace against one allocator and print the results.
+// Runs in a child process of its own.
+void replay(const ReplayAllocator& alloc,
+            const std::vector<AllocTraceRecord>& records,
+            const TraceSummary& summary) {
+  std::vector<void*> objects(summary.objects);
+  std::vector<uint64_t> sizes(summary.objects);
+  std::vector<uint32_t> latencies(records.size());
+  size_t failed = 0;
+
+  if (alloc.allocate == arena_allocate) {
+    ARENA = new Arena;
+  }
+
+  // Restart the peak RSS count at what the child inherited
+  std::ofstream("/proc/self/clear_refs") << "5";
+  size_t baseline = proc_status_bytes("VmRSS");
+
+  for (size_t i = 0; i < records.size(); ++i) {
+    const AllocTraceRecord& r = records[i];
+    void*& object = objects[r.object];
+    uint64_t start = now_ns();
+
+    try {
+      switch (r.op) {
+        case TRACE_MALLOC:
+          object = alloc.allocate(r.size);
+          break;
+        case TRACE_FREE:
+          alloc.release(object);
+          object = nullptr;
+          break;
+        case TRACE_REALLOC:
+          object = object != nullptr
+                       ? alloc.resize(object, sizes[r.object], r.size)
+                       : alloc.allocate(r.size);
+          break;
+      }
+    } catch (const std::bad_alloc&) {
+      std::printf("%s: exhausted after [%zu] of [%zu] calls\n", alloc.name, i,
+                  records.size());
+      return;
+    }
+
+    latencies[i] = static_cast<uint32_t>(
+        std::min<uint64_t>(now_ns() - start, UINT32_MAX));
+
+    if (r.op != TRACE_FREE) {
+      if (object == nullptr) {
+        ++failed;
+        continue;
+      }
+      touch(object, r.size);
+      sizes[r.object] = r.size;
+    }
+  }
+
+  size_t peak_rss = proc_status_bytes("VmHWM");
+  size_t growth = peak_rss > baseline ? peak_rss - baseline : 0;
+
+  for (void* object : objects) {
+    alloc.release(object);
+  }
+
+  uint64_t total = 0;
+  for (uint32_t ns : latencies) {
+    total += ns;
+  }
+  std::sort(latencies.begin(), latencies.end());
+  auto percentile = [&](double p) {
+    return latencies.empty()
+               ? 0u
+               : latencies[static_cast<size_t>(p * (latencies.size() - 1))];
+  };
+
+  // Memory the allocator held beyond what the trace had alive at its peak
+  double fragmentation =
+      growth > summary.peak_live
+          ? 100.0 * (growth - summary.peak_live) / growth
+          : 0.0;
+
+  std::printf("%s: throughput: [%.2f Mops/s] failed: [%zu]\n", alloc.name,
+              total != 0 ? 1e3 * records.size() / total : 0.0, failed);
+  std::printf("%s: latency ns p50: [%u] p90: [%u] p99: [%u] p99.9: [%u] "
+              "max: [%u]\n",
+              alloc.name, percentile(0.5), percentile(0.9), percentile(0.99),
+              percentile(0.999), percentile(1.0));
+  std::printf("%s: peak RSS: [%zu KB] growth: [%zu KB] fragmentation: "
+              "[%.1f%%]\n",
+              alloc.name, peak_rss / 1024, growth / 1024, fragmentation);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    std::cerr << "Usage: " << argv[0]
+              << " <file.trace> [c_malloc] [glibc] [arena]\n";
+    return 2;
+  }
+
+  std::vector<AllocTraceRecord> records;
+  if (!load_trace(argv[1], records)) {
+    std::cerr << argv[1] << ": not an allocation trace\n";
+    return 1;
+  }
+  TraceSummary summary = summarize(records);
+
+  std::printf("Trace: [%s] calls: [%zu] objects: [%zu] threads: [%zu]\n",
+              argv[1], records.size(), summary.objects, summary.threads);
+  std::printf("Recorded duration: [%.1f ms] peak live: [%zu KB]\n",
+              summary.duration / 1e6, summary.peak_live / 1024);
+
+  for (const ReplayAllocator& alloc : ALLOCATORS) {
+    bool selected = argc == 2;
+    for (int i = 2; i < argc; ++i) {
+      selected |= std::strcmp(argv[i], alloc.name) == 0;
+    }
+    if (!selected) {
+      continue;
+    }
+
+    std::fflush(stdout);
+    pid_t child = fork();
+    if (child == 0) {
+      replay(alloc, records, summary);
+      std::fflush(stdout);
+      _exit(0);
+    }
+
+    int status = 0;
+    waitpid(child, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+      std::printf("%s: replay crashed\n", alloc.name);
+    }
+  }
+  return 0;
+}